@@ -53,6 +53,7 @@ void BtreeCursor::close()
 		sqlite3BtreeCloseCursor( d_cur );
 		d_db = 0;
 		d_table = 0;
+		d_lastSorted.clear();
 	}
 }
 
@@ -68,6 +69,7 @@ void BtreeCursor::insert( const QByteArray& key, const QByteArray& value )
 	BtreeStore::WriteLock guard( d_db );
 	if( key.isEmpty() )
 		qWarning( "BtreeCursor::insert funktioniert nicht richtig mit leeren Keys" );
+	d_db->touch();
 	int res = sqlite3BtreeInsert( d_cur, key.data(), key.size(), 
 		value.data(), value.size(), 0, 0 );
 	if( res != SQLITE_OK )
@@ -77,6 +79,29 @@ void BtreeCursor::insert( const QByteArray& key, const QByteArray& value )
 	}
 }
 
+void BtreeCursor::insertSorted( const QByteArray& key, const QByteArray& value )
+{
+	checkOpen();
+	BtreeStore::WriteLock guard( d_db );
+	if( key.isEmpty() )
+		qWarning( "BtreeCursor::insertSorted funktioniert nicht richtig mit leeren Keys" );
+	int bias = 0;
+	if( !d_lastSorted.isEmpty() )
+	{
+		const int cmp = ::memcmp( d_lastSorted.constData(), key.constData(), qMin( d_lastSorted.size(), key.size() ) );
+		bias = ( cmp < 0 || ( cmp == 0 && d_lastSorted.size() < key.size() ) )? 1 : 0;
+	}
+	d_db->touch();
+	int res = sqlite3BtreeInsert( d_cur, key.data(), key.size(),
+		value.data(), value.size(), 0, bias );
+	if( res != SQLITE_OK )
+	{
+		guard.rollback();
+		throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
+	}
+	d_lastSorted = key;
+}
+
 QByteArray BtreeCursor::readKey() const
 {
 	checkOpen();
@@ -109,6 +134,57 @@ QByteArray BtreeCursor::readValue() const
 	return data;
 }
 
+const char* BtreeCursor::fetchKey( int& len ) const
+{
+	checkOpen();
+	BtreeStore::ReadLock lock( d_db );
+	i64 size;
+	int res = sqlite3BtreeKeySize( d_cur, &size );
+	if( res != SQLITE_OK )
+		throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
+	len = size;
+	if( size == 0 )
+		return "";
+	int amt = 0;
+	const void* p = sqlite3BtreeKeyFetch( d_cur, &amt );
+	if( p != 0 && amt >= size )
+		return (const char*)p; // Key liegt vollstaendig auf der Page
+	d_buf.resize( size );
+	res = sqlite3BtreeKey( d_cur, 0, size, d_buf.data() );
+	if( res != SQLITE_OK )
+		throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
+	return d_buf.constData();
+}
+
+const char* BtreeCursor::fetchValue( int& len ) const
+{
+	checkOpen();
+	BtreeStore::ReadLock lock( d_db );
+	u32 size;
+	int res = sqlite3BtreeDataSize( d_cur, &size );
+	if( res != SQLITE_OK )
+		throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
+	len = size;
+	if( size == 0 )
+		return "";
+	int amt = 0;
+	const void* p = sqlite3BtreeDataFetch( d_cur, &amt );
+	if( p != 0 && amt >= int(size) )
+		return (const char*)p; // Value liegt vollstaendig auf der Page
+	d_buf.resize( size );
+	res = sqlite3BtreeData( d_cur, 0, size, d_buf.data() );
+	if( res != SQLITE_OK )
+		throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
+	return d_buf.constData();
+}
+
+bool BtreeCursor::keyStartsWith( const QByteArray& prefix ) const
+{
+	int len;
+	const char* key = fetchKey( len );
+	return len >= prefix.size() && ::memcmp( key, prefix.constData(), prefix.size() ) == 0;
+}
+
 bool BtreeCursor::moveFirst()
 {
 	checkOpen();
@@ -177,13 +253,13 @@ bool BtreeCursor::moveTo( const QByteArray& key, bool partial )
 		if( compare == 0 )
 			return true;
 		else if( compare > 0 )
-			return readKey().startsWith( key );
+			return keyStartsWith( key );
 		else
 		{
 			if( !moveNext() ) // moveNext verschiebt den Cursor allenfalls ber den Schluss hinaus
 				return false;
 			else
-				return readKey().startsWith( key );
+				return keyStartsWith( key );
 		}
 	}else
 	{
@@ -196,7 +272,7 @@ bool BtreeCursor::moveTo( const QByteArray& key, bool partial )
 bool BtreeCursor::moveNext(const QByteArray& key)
 {
 	if( moveNext() )
-		return readKey().startsWith( key );
+		return keyStartsWith( key );
 	else
 		return false;
 }
@@ -205,7 +281,73 @@ void BtreeCursor::removePos()
 {
 	checkOpen();
 	BtreeStore::WriteLock guard( d_db );
+	d_db->touch();
 	int res = sqlite3BtreeDelete( d_cur );
 	if( res != SQLITE_OK )
 		throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
 }
+
+bool BtreeCursor::seekFrom( const QByteArray& lo )
+{
+	int compare;
+	int res = sqlite3BtreeMoveto( d_cur, lo.constData(), lo.size(), 0, &compare );
+	if( res != SQLITE_OK )
+		throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
+	if( compare < 0 )
+	{
+		int eof = 0;
+		res = sqlite3BtreeNext( d_cur, &eof );
+		if( res != SQLITE_OK )
+			throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
+		return eof == 0;
+	}
+	return sqlite3BtreeEof( d_cur ) == 0;
+}
+
+int BtreeCursor::removeRange( const QByteArray& prefix )
+{
+	checkOpen();
+	BtreeStore::WriteLock guard( d_db );
+	int n = 0;
+	// Sqlite setzt den Cursor nach jedem Delete auf die Wurzel zurueck, darum wird pro Eintrag
+	// wieder ab prefix gesucht; dafuer ohne Allokation und in einer einzigen Schreibtransaktion.
+	while( seekFrom( prefix ) && keyStartsWith( prefix ) )
+	{
+		d_db->touch();
+		int res = sqlite3BtreeDelete( d_cur );
+		if( res != SQLITE_OK )
+		{
+			guard.rollback();
+			throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
+		}
+		n++;
+	}
+	return n;
+}
+
+int BtreeCursor::removeRange( const QByteArray& lo, const QByteArray& hi )
+{
+	checkOpen();
+	BtreeStore::WriteLock guard( d_db );
+	int n = 0;
+	while( seekFrom( lo ) )
+	{
+		if( !hi.isEmpty() )
+		{
+			int len;
+			const char* key = fetchKey( len );
+			const int res = ::memcmp( key, hi.constData(), qMin( len, hi.size() ) );
+			if( res > 0 || ( res == 0 && len >= hi.size() ) )
+				break; // key >= hi
+		}
+		d_db->touch();
+		int res = sqlite3BtreeDelete( d_cur );
+		if( res != SQLITE_OK )
+		{
+			guard.rollback();
+			throw DatabaseException( DatabaseException::AccessCursor, sqlite3ErrStr( res ) );
+		}
+		n++;
+	}
+	return n;
+}
@@ -53,17 +53,34 @@ namespace Udb
 
 		// Read/Write
 		void insert( const QByteArray& key, const QByteArray& value ); // Unabhngig von Pos
+		// Fuer Bulk-Load mit aufsteigend sortierten Keys: Sqlite sucht mit appendBias zuerst am rechten
+		// Rand. Ist key nicht groesser als der zuletzt mit insertSorted eingefuegte, wird normal eingefuegt.
+		void insertSorted( const QByteArray& key, const QByteArray& value );
 		QByteArray readKey() const; // Pos
 		QByteArray readValue() const; // Pos
 		void removePos(); // VORSICHT: danach zeigt Cursor ins Kraut! Also nicht geeignet fr Move-Loops!
+		// Loescht alle Eintraege, deren Key mit prefix beginnt, bzw. mit lo <= Key < hi (hi leer..bis Ende).
+		// Alles in einer Schreibtransaktion; gibt die Anzahl geloeschter Eintraege zurueck. Pos danach undefiniert.
+		int removeRange( const QByteArray& prefix );
+		int removeRange( const QByteArray& lo, const QByteArray& hi );
+
+		// Zero-Copy-Zugriff auf Pos: Zeiger direkt in den Page-Buffer, gueltig bis der Cursor bewegt
+		// oder der Store geaendert wird. Nur bei Eintraegen mit Overflow-Pages wird in einen internen
+		// Buffer kopiert, der vom Cursor wiederverwendet wird.
+		const char* fetchKey( int& len ) const;
+		const char* fetchValue( int& len ) const;
+		bool keyStartsWith( const QByteArray& prefix ) const; // Pos, ohne Allokation
 
 		BtreeStore* getDb() const { return d_db; }
 	protected:
 		void checkOpen() const;
+		bool seekFrom( const QByteArray& lo ); // Pos auf erstem Key >= lo, false..kein solcher
 	private:
 		int d_table;
 		BtreeStore* d_db;
 		BtCursor* d_cur;
+		mutable QByteArray d_buf; // nur fuer fetchKey/fetchValue bei Overflow
+		QByteArray d_lastSorted; // letzter Key von insertSorted
 	};
 }
 
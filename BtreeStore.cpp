@@ -22,11 +22,18 @@
 #include <Sqlite3/sqlite3.h>
 #include "Private.h"
 #include <QBuffer>
+#include <QFileInfo>
+#include <QFile>
+#include <QTime>
+#include <cstdio>
 #include <cassert>
 using namespace Udb;
 
-static const int s_pageSize = SQLITE_DEFAULT_PAGE_SIZE;
+static const int s_minPageSize = 512; // Minimum von Sqlite
+const char* BtreeStore::s_memory = ":memory:";
 static const int s_schema = 15;
+static const int s_pageOverhead = 256; // RISK: PgHdr + MemPage + Hash pro Page im Pager, geschaetzt
+static const qint64 s_residentMem = 64 * 1024 * 1024; // Cache fuer resident ohne setCacheMemory
 
 BtreeStore::ReadLock::ReadLock( BtreeStore* db ):d_db(db)
 {
@@ -67,6 +74,11 @@ void BtreeStore::WriteLock::rollback()
 }
 
 BtreeStore::WriteLock::~WriteLock()
+{
+	commit();
+}
+
+void BtreeStore::WriteLock::commit()
 {
 	if( d_db )
 	{
@@ -75,11 +87,13 @@ BtreeStore::WriteLock::~WriteLock()
 #ifdef BTREESTORE_HAS_MUTEX
 		d_db->d_lock.unlock();
 #endif
+		d_db = 0;
 	}
 }
 
 BtreeStore::BtreeStore( QObject* owner ):
-	QObject( owner ), d_db(0), d_metaTable(0), d_txnLevel( 0)
+	QObject( owner ), d_db(0), d_metaTable(0), d_txnLevel( 0), d_changeCount(0), d_abortCount(0),
+	d_cacheMem(0), d_resident(false), d_autoVacuum(false), d_compactKeys(false), d_packedRecords(false)
 #ifdef BTREESTORE_HAS_MUTEX
 		,d_lock(QMutex::Recursive)
 #endif
@@ -100,10 +114,23 @@ void BtreeStore::setCacheSize( int numOfPages )
 	// Es gilt SQLITE_MAX_PAGE_COUNT, zur Zeit 1'073'741'823
 }
 
-void BtreeStore::open( const QString& path, bool readOnly )
+void BtreeStore::setCacheMemory( qint64 bytes )
+{
+	ReadLock lock( this );
+	d_cacheMem = bytes;
+	if( d_db == 0 || bytes <= 0 )
+		return; // wird bei open angewendet
+	const qint64 pages = bytes / ( sqlite3BtreeGetPageSize( getBt() ) + s_pageOverhead );
+	setCacheSize( qBound( qint64(10), pages, qint64(0x7fffffff) ) );
+}
+
+void BtreeStore::open( const QString& path, bool readOnly, bool resident, int pageSize, bool exclusive )
 {
 	ReadLock lock( this );
 	close();
+	if( pageSize != 0 && ( pageSize < s_minPageSize || pageSize > SQLITE_MAX_PAGE_SIZE ||
+		( pageSize & ( pageSize - 1 ) ) != 0 ) )
+		throw DatabaseException( DatabaseException::OpenDbFile, "invalid page size" );
 	d_path = path;
 	int res = sqlite3_open_v2( path.toUtf8(), // ":memory:"
 		&d_db, 
@@ -113,6 +140,14 @@ void BtreeStore::open( const QString& path, bool readOnly )
 		, 0 );
 	if( res != SQLITE_OK )
 		throw DatabaseException( DatabaseException::OpenDbFile, ::sqlite3ErrStr( res ) );
+	if( pageSize != 0 && !readOnly )
+		// Gilt nur, solange die Datei leer ist; sonst liest Sqlite die Groesse aus dem Datei-Header
+		sqlite3BtreeSetPageSize( getBt(), pageSize, -1 );
+	if( d_autoVacuum && !readOnly )
+		// Ebenso nur fuer leere Dateien; bestehende behalten ihren Modus
+		sqlite3BtreeSetAutoVacuum( getBt(), BTREE_AUTOVACUUM_INCR );
+	if( d_cacheMem > 0 )
+		setCacheMemory( d_cacheMem );
 
 	if( readOnly )
 	{
@@ -120,6 +155,12 @@ void BtreeStore::open( const QString& path, bool readOnly )
 
 		// riskant bei schreiben, keine Wirkung bei lesen: sqlite3BtreeSetSafetyLevel( getBt(), 1, 0 );
 
+		if( exclusive )
+			// Sqlite 3.5.7 kennt kein mmap. Im Exclusive-Mode gibt der Pager den Shared-Lock nach
+			// einer Lesetransaktion nicht mehr frei und muss darum den Cache nie mehr verwerfen
+			// oder den Datei-Header neu pruefen. Schreiber anderer Prozesse erhalten SQLITE_BUSY.
+			sqlite3PagerLockingMode( sqlite3BtreePager( getBt() ), PAGER_LOCKINGMODE_EXCLUSIVE );
+
 		unsigned int tmp;
 		res = sqlite3BtreeGetMeta( getBt(), s_schema, &tmp );
 		if( res != SQLITE_OK )
@@ -134,6 +175,19 @@ void BtreeStore::open( const QString& path, bool readOnly )
 			throw DatabaseException( DatabaseException::AccessMeta, "cannot create meta table in readonly database" );
 		}else
 			d_metaTable = tmp;
+
+		if( resident )
+		{
+			d_resident = true;
+			// Jede Page soll nur einmal von der Datei gelesen werden, aber hoechstens im Rahmen des
+			// Budgets; ohne setCacheMemory gilt s_residentMem, damit grosse Dateien nicht den ganzen
+			// Heap jedes Auswerteprozesses belegen. Den Rest haelt der Page-Cache des Betriebssystems.
+			const int pageSize = sqlite3BtreeGetPageSize( getBt() );
+			const qint64 budget = ( d_cacheMem > 0 )? d_cacheMem : s_residentMem;
+			const qint64 pages = qMin( QFileInfo( path ).size() / pageSize + 1,
+									   budget / ( pageSize + s_pageOverhead ) );
+			setCacheSize( qBound( qint64(SQLITE_DEFAULT_CACHE_SIZE), pages, qint64(0x7fffffff) ) );
+		}
 	}else
 	{
 		WriteLock guard( this );
@@ -165,6 +219,554 @@ void BtreeStore::open( const QString& path, bool readOnly )
 	}
 }
 
+static inline Btree* _bt( sqlite3* db )
+{
+	return db->aDb->pBt;
+}
+
+int BtreeStore::readPageSize( const QString& path )
+{
+	QFile f( path );
+	if( !f.open( QIODevice::ReadOnly ) )
+		return 0;
+	const QByteArray h = f.read( 18 );
+	if( h.size() < 18 || !h.startsWith( QByteArray( "SQLite format 3\0", 16 ) ) )
+		return 0;
+	return ( quint8(h[16]) << 8 ) | quint8(h[17]);
+}
+
+void BtreeStore::copyFrom( const QString& path )
+{
+	ReadLock lock( this );
+	checkOpen();
+	if( d_txnLevel > 0 )
+		throw DatabaseException( DatabaseException::StartTrans, "cannot copy within transaction" );
+	sqlite3* src = 0;
+	int res = sqlite3_open_v2( path.toUtf8(), &src, SQLITE_OPEN_READONLY, 0 );
+	if( res == SQLITE_OK )
+		res = sqlite3BtreeBeginTrans( _bt( src ), 0 );
+	if( res == SQLITE_OK )
+	{
+		res = sqlite3BtreeBeginTrans( getBt(), 1 );
+		if( res == SQLITE_OK )
+		{
+			// Dasselbe Verfahren wie bei VACUUM: alle Pages 1:1
+			res = sqlite3BtreeCopyFile( getBt(), _bt( src ) );
+			if( res == SQLITE_OK )
+				res = sqlite3BtreeCommit( getBt() );
+			else
+				sqlite3BtreeRollback( getBt() );
+		}
+		sqlite3BtreeCommit( _bt( src ) );
+	}
+	if( src )
+		sqlite3_close( src );
+	touch();
+	if( res != SQLITE_OK )
+		throw DatabaseException( DatabaseException::OpenDbFile, ::sqlite3ErrStr( res ) );
+	unsigned int tmp = 0;
+	res = sqlite3BtreeGetMeta( getBt(), s_schema, &tmp );
+	if( res != SQLITE_OK || tmp == 0 )
+		throw DatabaseException( DatabaseException::AccessMeta, "no meta table in copied database" );
+	d_metaTable = tmp;
+}
+
+void BtreeStore::copyTo( const QString& path )
+{
+	ReadLock lock( this );
+	checkOpen();
+	if( d_txnLevel > 0 )
+		throw DatabaseException( DatabaseException::StartTrans, "cannot copy within transaction" );
+	const QString tmp = path + QLatin1String( ".tmp" );
+	QFile::remove( tmp );
+	sqlite3* dst = 0;
+	int res = sqlite3_open_v2( tmp.toUtf8(), &dst, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0 );
+	if( res == SQLITE_OK )
+	{
+		// Die neue Datei ist noch leer, darum laesst sich die Page-Groesse noch setzen
+		sqlite3BtreeSetPageSize( _bt( dst ), getPageSize(), -1 );
+		res = sqlite3BtreeBeginTrans( getBt(), 0 );
+	}
+	if( res == SQLITE_OK )
+	{
+		res = sqlite3BtreeBeginTrans( _bt( dst ), 1 );
+		if( res == SQLITE_OK )
+		{
+			res = sqlite3BtreeCopyFile( _bt( dst ), getBt() );
+			if( res == SQLITE_OK )
+				res = sqlite3BtreeCommit( _bt( dst ) );
+			else
+				sqlite3BtreeRollback( _bt( dst ) );
+		}
+		sqlite3BtreeCommit( getBt() );
+	}
+	if( dst )
+		sqlite3_close( dst );
+	if( res != SQLITE_OK )
+	{
+		QFile::remove( tmp );
+		throw DatabaseException( DatabaseException::CommitTrans, ::sqlite3ErrStr( res ) );
+	}
+	replaceFile( tmp, path );
+}
+
+void BtreeStore::replaceFile( const QString& from, const QString& to )
+{
+	// Unter Unix ersetzt rename atomar; sonst muss das Ziel zuerst weg
+	if( std::rename( QFile::encodeName( from ).constData(), QFile::encodeName( to ).constData() ) != 0 )
+	{
+		QFile::remove( to );
+		if( !QFile::rename( from, to ) )
+			throw DatabaseException( DatabaseException::OpenDbFile, "cannot replace " + to );
+	}
+}
+
+quint32 BtreeStore::readPages( quint32 first, int count, QList<QByteArray>& pages, quint32* fileCounter )
+{
+	ReadLock lock( this );
+	checkOpen();
+	pages.clear();
+	if( d_txnLevel > 0 )
+		// Es wuerden nicht committete Pages gelesen, und Commit unten beendete die Schreibtransaktion
+		throw DatabaseException( DatabaseException::StartTrans, "cannot read pages within transaction" );
+	int res = sqlite3BtreeBeginTrans( getBt(), 0 );
+	if( res != SQLITE_OK )
+		throw DatabaseException( DatabaseException::StartTrans, ::sqlite3ErrStr( res ) );
+	Pager* pager = sqlite3BtreePager( getBt() );
+	const int pageSize = sqlite3BtreeGetPageSize( getBt() );
+	const quint32 total = sqlite3PagerPagecount( pager );
+	for( quint32 pgno = first; res == SQLITE_OK && pgno < first + count && pgno <= total; pgno++ )
+	{
+		DbPage* page = 0;
+		res = sqlite3PagerGet( pager, pgno, &page );
+		if( res == SQLITE_OK )
+		{
+			pages.append( QByteArray( (const char*)sqlite3PagerGetData( page ), pageSize ) );
+			sqlite3PagerUnref( page );
+		}
+	}
+	if( res == SQLITE_OK && fileCounter )
+	{
+		// Bytes 24..27 von Page 1, wird von Sqlite bei jedem Commit in die Datei erhoeht
+		DbPage* page = 0;
+		res = sqlite3PagerGet( pager, 1, &page );
+		if( res == SQLITE_OK )
+		{
+			const quint8* h = (const quint8*)sqlite3PagerGetData( page );
+			*fileCounter = ( h[24] << 24 ) | ( h[25] << 16 ) | ( h[26] << 8 ) | h[27];
+			sqlite3PagerUnref( page );
+		}
+	}
+	sqlite3BtreeCommit( getBt() ); // beendet nur die Lesetransaktion
+	if( res != SQLITE_OK )
+		throw DatabaseException( DatabaseException::AccessDatabase, ::sqlite3ErrStr( res ) );
+	return total;
+}
+
+bool BtreeStore::isAutoVacuum() const
+{
+	checkOpen();
+	return sqlite3BtreeGetAutoVacuum( getBt() ) != BTREE_AUTOVACUUM_NONE;
+}
+
+quint32 BtreeStore::getFreePageCount() const
+{
+	checkOpen();
+	ReadLock lock( const_cast<BtreeStore*>(this) );
+	unsigned int n = 0;
+	const int res = sqlite3BtreeGetMeta( getBt(), 1, &n ); // Meta 1 ist die Laenge der Freelist
+	if( res != SQLITE_OK )
+		throw DatabaseException( DatabaseException::AccessMeta, ::sqlite3ErrStr( res ) );
+	return n;
+}
+
+namespace Udb
+{
+	// Liest Btree-Pages gemaess Sqlite-Dateiformat direkt aus dem Pager; ausserhalb einer
+	// Transaktion des Stores wird dafuer eine Lesetransaktion gehalten.
+	class PageWalker
+	{
+	public:
+		struct Cell
+		{
+			quint64 d_key;
+			quint64 d_value;
+			quint32 d_overflow; // erste Overflow-Page oder 0
+		};
+		struct Page
+		{
+			bool d_leaf;
+			bool d_entries; // false..Zellen sind nur Separatoren (Leaf-Data-Tabellen)
+			int d_used;
+			QList<quint32> d_children;
+			QList<Cell> d_cells;
+		};
+
+		PageWalker( Btree* bt, bool ownTrans ):d_bt( bt ),d_mapNo( 0 ),d_own( false )
+		{
+			if( ownTrans )
+			{
+				const int res = sqlite3BtreeBeginTrans( d_bt, 0 );
+				if( res != SQLITE_OK )
+					throw DatabaseException( DatabaseException::StartTrans, ::sqlite3ErrStr( res ) );
+				d_own = true;
+			}
+			d_pager = sqlite3BtreePager( d_bt );
+			d_pageSize = sqlite3BtreeGetPageSize( d_bt );
+			d_total = sqlite3PagerPagecount( d_pager );
+			const QByteArray p1 = read( 1 );
+			d_usable = d_pageSize - quint8( p1[20] ); // Reserved Bytes am Ende jeder Page
+			d_maxLocal = ( d_usable - 12 ) * 64 / 255 - 23;
+			d_minLocal = ( d_usable - 12 ) * 32 / 255 - 23;
+		}
+		~PageWalker()
+		{
+			if( d_own )
+				sqlite3BtreeCommit( d_bt ); // beendet nur die Lesetransaktion
+		}
+		quint32 getTotal() const { return d_total; }
+		int getUsable() const { return d_usable; }
+		int getPageSize() const { return d_pageSize; }
+		static quint32 get2( const quint8* p ) { return ( p[0] << 8 ) | p[1]; }
+		static quint32 get4( const quint8* p ) { return ( p[0] << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3]; }
+		static int getVarint( const quint8* p, quint64& v )
+		{
+			v = 0;
+			for( int i = 0; i < 8; i++ )
+			{
+				v = ( v << 7 ) | ( p[i] & 0x7f );
+				if( ( p[i] & 0x80 ) == 0 )
+					return i + 1;
+			}
+			v = ( v << 8 ) | p[8];
+			return 9;
+		}
+		QByteArray read( quint32 pgno )
+		{
+			DbPage* page = 0;
+			const int res = sqlite3PagerGet( d_pager, pgno, &page );
+			if( res != SQLITE_OK )
+				throw DatabaseException( DatabaseException::AccessDatabase, ::sqlite3ErrStr( res ) );
+			QByteArray buf( (const char*)sqlite3PagerGetData( page ), d_pageSize );
+			sqlite3PagerUnref( page );
+			buf.append( QByteArray( 32, 0 ) ); // Varints am Page-Ende duerfen ueberlesen
+			return buf;
+		}
+		static bool mark( QByteArray& map, int from, int len )
+		{
+			// false..Bereich ausserhalb der Page oder bereits belegt
+			if( from < 0 || len <= 0 || from + len > map.size() )
+				return false;
+			char* m = map.data();
+			for( int i = from; i < from + len; i++ )
+			{
+				if( m[i] )
+					return false;
+				m[i] = 1;
+			}
+			return true;
+		}
+		bool parse( quint32 pgno, Page& pg )
+		{
+			// false..keine gueltige Btree-Page. Header, Freeblocks und Zellen muessen den Inhaltsbereich
+			// lueckenlos und ohne Ueberlappung belegen, sonst passt z.B. eine Overflow-Page zufaellig.
+			const QByteArray buf = read( pgno );
+			const quint8* d = (const quint8*)buf.constData();
+			const int hdr = ( pgno == 1 )? 100 : 0;
+			const quint8 flags = d[hdr];
+			const quint8 type = flags & ~PTF_LEAF;
+			if( type != 0 && type != PTF_ZERODATA && type != PTF_INTKEY && type != ( PTF_INTKEY | PTF_LEAFDATA ) )
+				return false;
+			if( d[hdr + 7] > 60 )
+				return false; // Sqlite defragmentiert vorher
+			pg.d_leaf = flags & 0x08;
+			const bool intKey = flags & 0x05;
+			const bool leafData = flags & 0x04;
+			const bool hasData = !( ( flags & 0x02 ) || ( !pg.d_leaf && leafData ) );
+			pg.d_entries = pg.d_leaf || !leafData;
+			const int childPtr = ( pg.d_leaf )? 0 : 4;
+			const int cellOffset = hdr + 8 + childPtr;
+			const int nCell = get2( d + hdr + 3 );
+			int top = get2( d + hdr + 5 );
+			if( top == 0 )
+				top = 65536;
+			if( cellOffset + 2 * nCell > top || top > d_usable )
+				return false;
+			QByteArray map( d_usable, 0 );
+			int covered = 0; // Bytes ab top in Freeblocks und Zellen
+			int free = top - cellOffset - 2 * nCell + d[hdr + 7];
+			quint32 fb = get2( d + hdr + 1 );
+			while( fb != 0 )
+			{
+				// Freeblocks liegen aufsteigend im Inhaltsbereich
+				if( int(fb) < top || int(fb) + 4 > d_usable )
+					return false;
+				const int len = get2( d + fb + 2 );
+				if( len < 4 || !mark( map, fb, len ) )
+					return false;
+				free += len;
+				covered += len;
+				const quint32 next = get2( d + fb );
+				if( next != 0 && next <= fb + len )
+					return false;
+				fb = next;
+			}
+			pg.d_used = d_usable - free;
+			pg.d_children.clear();
+			pg.d_cells.clear();
+			const int maxLocal = ( leafData )? d_usable - 35 : d_maxLocal;
+			for( int i = 0; i < nCell; i++ )
+			{
+				const int pc = get2( d + cellOffset + 2 * i );
+				if( pc < top || pc + childPtr >= d_usable )
+					return false;
+				const quint8* p = d + pc;
+				int n = childPtr;
+				if( childPtr )
+				{
+					const quint32 child = get4( p );
+					if( child < 2 || child > d_total )
+						return false;
+					pg.d_children.append( child );
+				}
+				quint64 nData = 0;
+				quint64 nKey = 0;
+				if( hasData )
+					n += getVarint( p + n, nData );
+				n += getVarint( p + n, nKey );
+				Cell c;
+				c.d_key = ( intKey )? 0 : nKey;
+				c.d_value = nData;
+				c.d_overflow = 0;
+				const quint64 payload = ( intKey )? nData : nData + nKey;
+				int size = n;
+				if( payload > quint64( maxLocal ) )
+				{
+					int local = d_minLocal + ( payload - d_minLocal ) % ( d_usable - 4 );
+					if( local > maxLocal )
+						local = d_minLocal;
+					if( pc + n + local + 4 > d_usable )
+						return false;
+					c.d_overflow = get4( p + n + local );
+					if( c.d_overflow < 2 || c.d_overflow > d_total )
+						return false;
+					size += local + 4;
+				}else
+					size += int( payload );
+				if( size < 4 )
+					size = 4; // Sqlite belegt mindestens 4 Bytes pro Zelle
+				if( !mark( map, pc, size ) )
+					return false;
+				covered += size;
+				pg.d_cells.append( c );
+			}
+			if( !pg.d_leaf )
+			{
+				const quint32 right = get4( d + hdr + 8 );
+				if( right < 2 || right > d_total )
+					return false;
+				pg.d_children.append( right );
+			}
+			if( covered + d[hdr + 7] != d_usable - top )
+				return false; // Luecken im Inhaltsbereich
+			return true;
+		}
+		quint8 ptrmapType( quint32 pgno )
+		{
+			// Eintrag <type><parent> der Pointer-Map (Auto-Vacuum) fuer pgno, 0..keiner
+			const quint32 per = d_usable / 5 + 1;
+			quint32 map = ( ( pgno - 2 ) / per ) * per + 2;
+			if( map == pendingPage() )
+				map++;
+			if( pgno <= map || map > d_total )
+				return 0;
+			const int offset = 5 * ( pgno - map - 1 );
+			if( offset + 5 > d_usable )
+				return 0;
+			if( map != d_mapNo )
+			{
+				d_map = read( map ); // aufeinanderfolgende Pages liegen in derselben Map-Page
+				d_mapNo = map;
+			}
+			return quint8( d_map[offset] );
+		}
+		quint32 pendingPage() const { return 0x40000000 / d_pageSize + 1; } // Page mit dem Lock-Byte bleibt leer
+		quint32 chain( quint32 pgno, QSet<quint32>& seen )
+		{
+			// Anzahl Overflow-Pages ab pgno
+			quint32 n = 0;
+			while( pgno != 0 && pgno <= d_total && !seen.contains( pgno ) )
+			{
+				seen.insert( pgno );
+				n++;
+				pgno = get4( (const quint8*)read( pgno ).constData() );
+			}
+			return n;
+		}
+		static int bucket( quint64 size )
+		{
+			int b = 0;
+			while( b < BtreeStore::TableStats::Buckets - 1 && ( quint64(1) << b ) <= size )
+				b++;
+			return b;
+		}
+		void walk( quint32 pgno, int depth, BtreeStore::TableStats& s, QSet<quint32>& seen )
+		{
+			if( pgno == 0 || pgno > d_total || seen.contains( pgno ) )
+				return; // defekte Verweise nicht weiter verfolgen
+			seen.insert( pgno );
+			Page pg;
+			if( !parse( pgno, pg ) )
+				throw DatabaseException( DatabaseException::DatabaseFormat,
+										 QString( "invalid btree page %1" ).arg( pgno ) );
+			s.d_pages++;
+			if( pg.d_leaf )
+				s.d_leafPages++;
+			if( depth > s.d_depth )
+				s.d_depth = depth;
+			s.d_used += pg.d_used;
+			s.d_capacity += d_usable;
+			for( int i = 0; i < pg.d_cells.size(); i++ )
+			{
+				const Cell& c = pg.d_cells[i];
+				if( pg.d_entries )
+				{
+					s.d_entries++;
+					s.d_payload += c.d_key + c.d_value;
+					s.d_keySizes[ bucket( c.d_key ) ]++;
+					s.d_valueSizes[ bucket( c.d_value ) ]++;
+				}
+				if( c.d_overflow )
+					s.d_overflowPages += chain( c.d_overflow, seen );
+			}
+			for( int i = 0; i < pg.d_children.size(); i++ )
+				walk( pg.d_children[i], depth + 1, s, seen );
+		}
+	private:
+		Btree* d_bt;
+		Pager* d_pager;
+		quint32 d_total;
+		int d_pageSize;
+		int d_usable;
+		int d_maxLocal;
+		int d_minLocal;
+		QByteArray d_map;
+		quint32 d_mapNo;
+		bool d_own;
+	};
+}
+
+BtreeStore::TableStats BtreeStore::analyzeTable( int table, QSet<quint32>* visited ) const
+{
+	ReadLock lock( const_cast<BtreeStore*>(this) );
+	checkOpen();
+	TableStats s;
+	s.d_table = table;
+	PageWalker w( getBt(), d_txnLevel == 0 );
+	QSet<quint32> seen;
+	w.walk( table, 1, s, ( visited )? *visited : seen );
+	return s;
+}
+
+quint32 BtreeStore::getPageCount() const
+{
+	ReadLock lock( const_cast<BtreeStore*>(this) );
+	checkOpen();
+	PageWalker w( getBt(), d_txnLevel == 0 );
+	return w.getTotal();
+}
+
+QList<int> BtreeStore::findOtherRoots( const QSet<quint32>& visited ) const
+{
+	ReadLock lock( const_cast<BtreeStore*>(this) );
+	checkOpen();
+	PageWalker w( getBt(), d_txnLevel == 0 );
+	QSet<quint32> skip = visited;
+	skip.insert( 1 ); // Sqlite-Schema, von BtreeStore nicht verwendet
+	// Freelist: Trunk-Pages mit <next> <n> <leaf>*
+	const QByteArray p1 = w.read( 1 );
+	quint32 trunk = PageWalker::get4( (const quint8*)p1.constData() + 32 );
+	while( trunk != 0 && trunk <= w.getTotal() && !skip.contains( trunk ) )
+	{
+		skip.insert( trunk );
+		const QByteArray t = w.read( trunk );
+		const quint8* d = (const quint8*)t.constData();
+		const quint32 n = qMin( PageWalker::get4( d + 4 ), quint32( w.getUsable() / 4 - 2 ) );
+		for( quint32 i = 0; i < n; i++ )
+			skip.insert( PageWalker::get4( d + 8 + 4 * i ) );
+		trunk = PageWalker::get4( d );
+	}
+	const quint32 pending = w.pendingPage();
+	skip.insert( pending );
+	const bool autoVacuum = isAutoVacuum();
+	if( autoVacuum )
+	{
+		// Pointer-Map-Pages
+		const quint32 per = w.getUsable() / 5 + 1;
+		for( quint32 p = 2; p <= w.getTotal(); p += per )
+			skip.insert( ( p == pending )? p + 1 : p );
+	}
+	QList<quint32> btree;
+	QSet<quint32> referenced;
+	PageWalker::Page pg;
+	for( quint32 pgno = 2; pgno <= w.getTotal(); pgno++ )
+	{
+		if( skip.contains( pgno ) )
+			continue;
+		if( autoVacuum )
+		{
+			// Die Pointer-Map kennt die Wurzeln; verwaiste Overflow-Pages sind dort keine
+			if( w.ptrmapType( pgno ) == PTRMAP_ROOTPAGE && w.parse( pgno, pg ) )
+				btree.append( pgno );
+			continue;
+		}
+		if( !w.parse( pgno, pg ) )
+			continue;
+		btree.append( pgno );
+		for( int i = 0; i < pg.d_children.size(); i++ )
+			referenced.insert( pg.d_children[i] );
+		for( int i = 0; i < pg.d_cells.size(); i++ )
+			if( pg.d_cells[i].d_overflow )
+				w.chain( pg.d_cells[i].d_overflow, referenced );
+	}
+	QList<int> roots;
+	for( int i = 0; i < btree.size(); i++ )
+		if( !referenced.contains( btree[i] ) )
+			roots.append( btree[i] );
+	return roots;
+}
+
+bool BtreeStore::incrementalVacuum( int maxMillis )
+{
+	ReadLock lock( this );
+	checkOpen();
+	if( isReadOnly() || !isAutoVacuum() )
+		return true;
+	if( getBt()->pBt->pCursor != 0 )
+		return false; // verschobene Pages wuerden offene Cursor ungueltig machen
+	QTime clock;
+	clock.start();
+	WriteLock guard( this );
+	touch();
+	int res = SQLITE_OK;
+	while( res == SQLITE_OK && clock.elapsed() < maxMillis )
+		res = sqlite3BtreeIncrVacuum( getBt() ); // eine Page pro Aufruf; gekuerzt wird beim Commit
+	if( res == SQLITE_DONE )
+		return true;
+	if( res != SQLITE_OK )
+	{
+		guard.rollback();
+		throw DatabaseException( DatabaseException::CommitTrans, ::sqlite3ErrStr( res ) );
+	}
+	return false;
+}
+
+int BtreeStore::getPageSize() const
+{
+	checkOpen();
+	return sqlite3BtreeGetPageSize( getBt() );
+}
+
 bool BtreeStore::isReadOnly() const
 {
 	checkOpen();
@@ -178,6 +780,8 @@ void BtreeStore::close()
 		sqlite3_close( d_db );
 	d_db = 0;
 	d_metaTable = 0;
+	d_resident = false;
+	touch();
 }
 
 void BtreeStore::checkOpen() const
@@ -215,6 +819,8 @@ void BtreeStore::transAbort()
 {
 	checkOpen();
 	d_txnLevel = 0; // Breche sofort ab
+	touch();
+	d_abortCount++;
 	if( !isReadOnly() )
 		sqlite3BtreeRollback( getBt() );
 }
@@ -236,6 +842,16 @@ void BtreeStore::dropTable( int table )
 	ReadLock lock( this );
 	checkOpen();
 	WriteLock guard( this );
+	touch();
+	if( isAutoVacuum() )
+	{
+		// Mit Auto-Vacuum verschiebt Sqlite die letzte Root-Page in die frei gewordene, womit
+		// sich die Nummer einer anderen Tabelle aendern wuerde. Die Root-Page bleibt darum stehen.
+		int res = sqlite3BtreeClearTable( getBt(), table );
+		if( res != SQLITE_OK )
+			throw DatabaseException( DatabaseException::RemoveTable, sqlite3ErrStr( res ) );
+		return;
+	}
 	int res = sqlite3BtreeDropTable( getBt(), table, 0 );
 	if( res != SQLITE_OK )
 		throw DatabaseException( DatabaseException::RemoveTable, sqlite3ErrStr( res ) );
@@ -246,6 +862,7 @@ void BtreeStore::clearTable( int table )
 	ReadLock lock( this );
 	checkOpen();
 	WriteLock guard( this );
+	touch();
 	int res = sqlite3BtreeClearTable( getBt(), table);
 	if( res != SQLITE_OK )
 		throw DatabaseException( DatabaseException::ClearTable, sqlite3ErrStr( res ) );
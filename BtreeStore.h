@@ -22,6 +22,13 @@
 
 #include <QObject>
 #include <QMutex>
+#include <QVector>
+#include <QSet>
+
+#if defined(DATABASE_HAS_MUTEX) && !defined(BTREESTORE_HAS_MUTEX)
+// Database::ReadLock laesst Leser parallel zu; der Btree muss dann selber serialisieren
+#define BTREESTORE_HAS_MUTEX
+#endif
 
 struct Btree;
 struct sqlite3;
@@ -32,6 +39,8 @@ namespace Udb
 
 	// Wir verwenden nicht SQLITE_THREADSAFE.
 	// Darum wird hier ein Mutex verwendet zur Serialisierung aller Lese- und Schreibzugriffe.
+	// Parallele Leser ermoeglicht Database::ReadLock; hier werden nur die einzelnen Btree-Aufrufe
+	// serialisiert, nicht die ganze Leseoperation.
 	class BtreeStore : public QObject
 	{
 	public:
@@ -50,15 +59,51 @@ namespace Udb
 			WriteLock( BtreeStore* );
 			~WriteLock();
 			void rollback();
+			void commit(); // vorzeitig, wie Destruktor
 		private:
 			BtreeStore* d_db;
 		};
 
+		struct TableStats
+		{
+			enum { Buckets = 32 };
+			int d_table;			// Root-Page
+			quint32 d_pages;		// Btree-Pages inkl. Root, ohne Overflow-Pages
+			quint32 d_leafPages;
+			quint32 d_overflowPages;
+			int d_depth;			// 1..nur Root
+			quint64 d_entries;
+			quint64 d_payload;		// Key- und Value-Bytes aller Eintraege
+			quint64 d_used;			// belegte Bytes der Btree-Pages
+			quint64 d_capacity;		// nutzbare Bytes der Btree-Pages
+			QVector<quint64> d_keySizes;	// Histogramm, Bucket i zaehlt Groessen < 2^i und >= 2^(i-1)
+			QVector<quint64> d_valueSizes;
+			double getFill() const { return ( d_capacity )? double( d_used ) / d_capacity : 0.0; }
+			TableStats():d_table(0),d_pages(0),d_leafPages(0),d_overflowPages(0),d_depth(0),
+				d_entries(0),d_payload(0),d_used(0),d_capacity(0),
+				d_keySizes(Buckets),d_valueSizes(Buckets){}
+		};
+
 		BtreeStore( QObject* owner = 0 );
 		~BtreeStore(); // threadsafe
 
-		void open( const QString& path, bool readOnly = false ); // threadsafe
+		// resident (nur mit readOnly): der Cache wird auf die ganze Datei dimensioniert, hoechstens
+		// auf setCacheMemory bzw. 64 MB ohne Budget.
+		// pageSize: Zweierpotenz 512..SQLITE_MAX_PAGE_SIZE, nur beim Anlegen der Datei wirksam; 0..Default
+		// exclusive (nur mit readOnly): Shared-Lock und Page-Cache bleiben bis close() erhalten.
+		// Schreiber anderer Prozesse koennen waehrenddessen nicht committen (SQLITE_BUSY).
+		void open( const QString& path, bool readOnly = false, bool resident = false, int pageSize = 0,
+				   bool exclusive = false ); // threadsafe
 		void close();	// threadsafe
+		// Ersetzt den ganzen Inhalt durch die Pages der Datei; die Page-Groessen muessen uebereinstimmen
+		void copyFrom( const QString& path ); // threadsafe
+		// Schreibt eine Kopie aller Pages in eine neue Datei und ersetzt damit path atomar
+		void copyTo( const QString& path ); // threadsafe
+		static int readPageSize( const QString& path ); // aus dem Datei-Header, 0 falls keine Sqlite-Datei
+		static void replaceFile( const QString& from, const QString& to ); // wo moeglich atomar
+		// Liest bis zu count Pages ab first (1-basiert) in einer kurzen Lesetransaktion. Gibt die
+		// aktuelle Anzahl Pages zurueck; fileCounter erhaelt den Change-Counter aus dem Datei-Header.
+		quint32 readPages( quint32 first, int count, QList<QByteArray>& pages, quint32* fileCounter = 0 ); // threadsafe
 
 		void transBegin(); 
 		void transCommit();
@@ -73,16 +118,58 @@ namespace Udb
 		bool isTrans() const { return d_txnLevel > 0; }
 		const QString& getPath() const { return d_path; }
 		bool isReadOnly() const;
+		bool isResident() const { return d_resident; }
+		// Key-Format der Objekt-Tabelle, wird von Record interpretiert und von Database aus der Meta gesetzt
+		void setCompactKeys( bool on ) { d_compactKeys = on; }
+		bool hasCompactKeys() const { return d_compactKeys; }
+		// Objekt-Tabelle kann gepackte Zeilen enthalten (Record::FieldPacked); sonst wird nicht danach gesucht
+		void setPackedRecords( bool on ) { d_packedRecords = on; }
+		bool hasPackedRecords() const { return d_packedRecords; }
+		int getPageSize() const;
+		bool isInMemory() const { return d_path == QLatin1String( s_memory ); }
+		static const char* s_memory;
 		void setCacheSize( int numOfPages );
+		// Cache-Budget in Bytes, wird auf Anzahl Pages umgerechnet; gilt auch fuer nachfolgende open()
+		void setCacheMemory( qint64 bytes );
+		qint64 getCacheMemory() const { return d_cacheMem; }
+		// Inkrementelles Auto-Vacuum; wirkt nur beim Anlegen einer Datei und gilt fuer nachfolgende open()
+		void setAutoVacuum( bool on ) { d_autoVacuum = on; }
+		bool isAutoVacuum() const;
+		quint32 getFreePageCount() const;
+		quint32 getPageCount() const; // threadsafe, Laenge der Datei in Pages
+		// Verschiebt Pages vom Dateiende in freie Pages und kuerzt die Datei, hoechstens maxMillis lang.
+		// true..keine freien Pages mehr; false..Zeit abgelaufen oder wegen offener Cursor nichts getan
+		bool incrementalVacuum( int maxMillis );
+		// Liest alle Pages des Btree direkt vom Pager; visited erhaelt die Nummern aller besuchten Pages
+		// inkl. Overflow. Das kostet einen vollen Durchlauf des Btree.
+		TableStats analyzeTable( int table, QSet<quint32>* visited = 0 ) const; // threadsafe
+		// Heuristik: Roots von Btrees unter den Pages, die weder in visited noch in der Freelist sind,
+		// d.h. Tabellen, die nirgends in der Meta verzeichnet sind (z.B. Globals)
+		QList<int> findOtherRoots( const QSet<quint32>& visited ) const; // threadsafe
+		// Wird bei jeder Schreiboperation erhoeht; damit koennen offen gehaltene Cursor erkennen,
+		// ob sie neu positioniert werden muessen.
+		quint32 getChangeCount() const { return d_changeCount; }
+		// Wird bei jedem transAbort erhoeht; damit erkennt man, ob eigene Schreiboperationen
+		// moeglicherweise zurueckgerollt wurden.
+		quint32 getAbortCount() const { return d_abortCount; }
 	protected:
 		void checkOpen() const;
+		void touch() { d_changeCount++; }
 	private:
 		friend class Locker;
 		friend class WriteLock;
+		friend class BtreeCursor;
 		sqlite3* d_db;
 		qint32 d_txnLevel;
+		quint32 d_changeCount;
+		quint32 d_abortCount;
+		qint64 d_cacheMem;
 		int d_metaTable;
 		QString d_path; 
+		bool d_resident;
+		bool d_autoVacuum;
+		bool d_compactKeys;
+		bool d_packedRecords;
 #ifdef BTREESTORE_HAS_MUTEX
 		QMutex d_lock;
 #endif
@@ -17,11 +17,12 @@
 * http://www.gnu.org/copyleft/gpl.html.
 */
 #include "Database.h"
-#include "Database.h"
 #include "BtreeCursor.h"
 #include "BtreeStore.h"
 #include "DatabaseException.h"
 #include "BtreeMeta.h"
+#include "Transaction.h"
+#include "Record.h"
 #include <Stream/DataCell.h>
 #include <Stream/DataReader.h>
 #include <Stream/DataWriter.h>
@@ -32,38 +33,137 @@
 #include <QCoreApplication>
 #include <QSettings>
 #include <QProcess>
+#include <QThread>
+#include <QQueue>
+#include <QTemporaryFile>
+#include <QTextStream>
 #include <cassert>
+#include <climits>
 using namespace Udb;
 using namespace Stream;
 
 static const char* s_dbFormat = "{6D20986B-36ED-4571-AD5E-26734CCFB542}";
+static const int s_maxBackupPasses = 8;
+static const quint32 s_queueBlock = 256; // Anzahl Queue-Nummern pro Reservation
+
+namespace Udb
+{
+	// Schreibt die mit Transaction::commitAsync uebergebenen Aenderungen in Reihenfolge der Uebergabe
+	class AsyncWriter : public QThread
+	{
+	public:
+		AsyncWriter():d_quit(false) {}
+		void enqueue( Transaction* txn )
+		{
+			QMutexLocker l( &d_lock );
+			d_jobs.enqueue( txn );
+			d_wake.wakeOne();
+		}
+		void stop()
+		{
+			// Arbeitet die Warteschlange noch ab
+			{
+				QMutexLocker l( &d_lock );
+				d_quit = true;
+				d_wake.wakeOne();
+			}
+			wait();
+		}
+	protected:
+		void run()
+		{
+			while( true )
+			{
+				Transaction* txn = 0;
+				{
+					QMutexLocker l( &d_lock );
+					while( d_jobs.isEmpty() && !d_quit )
+						d_wake.wait( &d_lock );
+					if( d_jobs.isEmpty() )
+						return;
+					txn = d_jobs.dequeue();
+				}
+				txn->writePending();
+			}
+		}
+	private:
+		QMutex d_lock;
+		QWaitCondition d_wake;
+		QQueue<Transaction*> d_jobs;
+		bool d_quit;
+	};
+}
+
+#ifdef DATABASE_HAS_MUTEX
+static void _lockWrite( QReadWriteLock& lock, QAtomicPointer<void>& owner, int& depth )
+{
+	lock.lockForWrite();
+	owner.fetchAndStoreOrdered( QThread::currentThreadId() );
+	depth++;
+}
+
+static void _unlockWrite( QReadWriteLock& lock, QAtomicPointer<void>& owner, int& depth )
+{
+	if( --depth == 0 )
+		owner.fetchAndStoreOrdered( 0 );
+	lock.unlock();
+}
+#endif
 
 Database::Lock::Lock( Database* db ):d_db(db)
 {
 	assert( db );
 #ifdef DATABASE_HAS_MUTEX
-	db->d_lock.lock();
+	_lockWrite( db->d_lock, db->d_lockOwner, db->d_lockDepth );
 #endif
 }
 
 Database::Lock::~Lock()
 {
 #ifdef DATABASE_HAS_MUTEX
-	d_db->d_lock.unlock();
+	_unlockWrite( d_db->d_lock, d_db->d_lockOwner, d_db->d_lockDepth );
 #endif
 }
 
-Database::TxnGuard::TxnGuard( Database* db ):d_db(db)
+Database::ReadLock::ReadLock( Database* db ):d_db(db)
 {
 	assert( db );
 #ifdef DATABASE_HAS_MUTEX
-	db->d_lock.lock();
+	// QReadWriteLock::Recursive erlaubt lockForRead unter lockForWrite desselben Threads nicht.
+	// d_lockOwner wird atomar gelesen (testAndSet mit gleichem Wert aendert nichts); ein fremder
+	// Thread kann darin nie seine eigene Id finden.
+	void* self = QThread::currentThreadId();
+	if( db->d_lockOwner.testAndSetOrdered( self, self ) )
+		d_db = 0;
+	else
+		db->d_lock.lockForRead();
 #endif
-#ifdef BTREESTORE_HAS_MUTEX
-	db->d_db->d_lock.lock();
+}
+
+Database::ReadLock::~ReadLock()
+{
+#ifdef DATABASE_HAS_MUTEX
+	if( d_db )
+		d_db->d_lock.unlock();
+#endif
+}
+
+Database::TxnGuard::TxnGuard( Database* db ):d_db(db)
+{
+	assert( db );
+	// Sperrreihenfolge siehe Database.h. Der exklusive d_lock haelt alle anderen Zugriffe fern;
+	// der Store-Mutex wird wie ueberall nur pro Aufruf gesperrt, damit innerhalb des TxnGuard
+	// noch d_groupLock gesperrt werden darf (Commit, closeCommitGroup).
+#ifdef DATABASE_HAS_MUTEX
+	_lockWrite( db->d_lock, db->d_lockOwner, db->d_lockDepth );
+#elif defined(BTREESTORE_HAS_MUTEX)
+	db->d_db->d_lock.lock(); // ohne d_lock schuetzt nur der Store-Mutex die Transaktion
 #endif
 	if( !db->isReadOnly() )
+	{
+		BtreeStore::ReadLock store( db->d_db );
 		db->d_db->transBegin();
+	}
 }
 
 void Database::TxnGuard::rollback()
@@ -71,12 +171,14 @@ void Database::TxnGuard::rollback()
 	if( d_db )
 	{
 		if( !d_db->isReadOnly() )
+		{
+			BtreeStore::ReadLock store( d_db->d_db );
 			d_db->d_db->transAbort();
-#ifdef BTREESTORE_HAS_MUTEX
-		d_db->d_db->d_lock.unlock();
-#endif
+		}
 #ifdef DATABASE_HAS_MUTEX
-		d_db->d_lock.unlock();
+		_unlockWrite( d_db->d_lock, d_db->d_lockOwner, d_db->d_lockDepth );
+#elif defined(BTREESTORE_HAS_MUTEX)
+		d_db->d_db->d_lock.unlock();
 #endif
 		d_db = 0;
 	}
@@ -87,12 +189,14 @@ void Database::TxnGuard::commit()
 	if( d_db )
 	{
 		if( !d_db->isReadOnly() )
+		{
+			BtreeStore::ReadLock store( d_db->d_db );
 			d_db->d_db->transCommit();
-#ifdef BTREESTORE_HAS_MUTEX
-		d_db->d_db->d_lock.unlock();
-#endif
+		}
 #ifdef DATABASE_HAS_MUTEX
-		d_db->d_lock.unlock();
+		_unlockWrite( d_db->d_lock, d_db->d_lockOwner, d_db->d_lockDepth );
+#elif defined(BTREESTORE_HAS_MUTEX)
+		d_db->d_db->d_lock.unlock();
 #endif
 		d_db = 0;
 	}
@@ -106,10 +210,29 @@ Database::TxnGuard::~TxnGuard()
 
 Database::Database(QObject*p):QObject(p)
 #ifdef DATABASE_HAS_MUTEX
-	,d_lock(QMutex::Recursive)
+	,d_lock(QReadWriteLock::Recursive),d_lockOwner(0),d_lockDepth(0),d_atomLock(QMutex::Recursive)
 #endif
+	,d_groupMax(0),d_groupWindow(0),d_groupCount(0),d_groupNr(0),d_groupSeq(0),d_groupClosed(0),d_groupAborts(0)
 {
 	d_db = 0;
+	d_writer = 0;
+	d_cacheMem = 0;
+	d_autoVacuum = false;
+	d_recycleOids = false;
+	d_oidFree = true;
+	d_oidBlock = 1024;
+	d_oidNext = 0;
+	d_oidLimit = 0;
+	d_oidAborts = 0;
+	d_compactKeys = false;
+	d_fieldCache.setMaxCost( 0 );
+	d_fieldHits = 0;
+	d_fieldMisses = 0;
+	d_fieldInvalidations = 0;
+	d_fieldAborts = 0;
+	d_uuidAborts = 0;
+	d_uuidToOid.setMaxCost( 10000 );
+	d_oidToUuid.setMaxCost( 10000 );
 	qRegisterMetaType<Udb::UpdateInfo>();
 }
 
@@ -131,18 +254,326 @@ void Database::removeObserver( QObject* obj, const char* slot )
 	// NOTE: disconnect ist threadsafe
 }
 
-void Database::open( const QString& path, bool readOnly )
+void Database::open( const QString& path, bool readOnly, bool resident, int pageSize, bool exclusive )
 {
+	stopWriter();
 	Lock lock( this );
 	close();
 	QFileInfo info( path );
 	d_db = new BtreeStore( this );
+	d_db->setCacheMemory( d_cacheMem ); // vor open, damit bereits beim Laden der Meta wirksam
+	d_db->setAutoVacuum( d_autoVacuum );
     // NOTE: in Linux wird sonst der Pfad zum Symlink der DbPath
     d_db->open( (info.isSymLink())?info.symLinkTarget():info.absoluteFilePath(),
-                !info.isWritable() && info.exists() || readOnly );
+                !info.isWritable() && info.exists() || readOnly || resident || exclusive, resident, pageSize,
+				exclusive );
+	loadMeta();
+}
+
+void Database::openInMemory( int pageSize )
+{
+	stopWriter();
+	Lock lock( this );
+	close();
+	d_db = new BtreeStore( this );
+	d_db->setCacheMemory( d_cacheMem );
+	d_db->setAutoVacuum( d_autoVacuum );
+	d_db->open( BtreeStore::s_memory, false, false, pageSize );
 	loadMeta();
 }
 
+void Database::loadFrom( const QString& path )
+{
+	const int pageSize = BtreeStore::readPageSize( path );
+	if( pageSize == 0 )
+		throw DatabaseException( DatabaseException::OpenDbFile, "not a database file: " + path );
+	openInMemory( pageSize );
+	Lock lock( this );
+	try
+	{
+		d_db->copyFrom( path );
+	}catch( ... )
+	{
+		close();
+		throw;
+	}
+	clearCaches();
+	d_meta = Meta();
+	loadMeta();
+}
+
+void Database::saveTo( const QString& path )
+{
+	checkOpen();
+	Lock lock( this );
+	closeCommitGroup( d_groupNr );
+	d_db->copyTo( path );
+}
+
+static quint64 _pageHash( const QByteArray& page )
+{
+	// FNV-1a mit 64 Bit
+	quint64 h = Q_UINT64_C(14695981039346656037);
+	const uchar* p = (const uchar*)page.constData();
+	for( int i = 0; i < page.size(); i++ )
+	{
+		h ^= p[i];
+		h *= Q_UINT64_C(1099511628211);
+	}
+	return h;
+}
+
+void Database::backup( const QString& path, int pagesPerStep )
+{
+	const QString tmp = path + QLatin1String( ".tmp" );
+	{
+		QFile out( tmp );
+		if( !out.open( QIODevice::ReadWrite | QIODevice::Truncate ) )
+			throw DatabaseException( DatabaseException::OpenDbFile, "cannot create " + tmp );
+		try
+		{
+			backup( &out, pagesPerStep );
+		}catch( ... )
+		{
+			out.close();
+			QFile::remove( tmp );
+			throw;
+		}
+	}
+	BtreeStore::replaceFile( tmp, path );
+}
+
+void Database::backup( QIODevice* out, int pagesPerStep )
+{
+	checkOpen();
+	if( out == 0 || !out->isWritable() )
+		throw DatabaseException( DatabaseException::AccessDatabase, "backup device not writable" );
+	if( out->isSequential() )
+	{
+		// Das Nachfuehren braucht wahlfreien Zugriff; darum zuerst in eine temporaere Datei
+		QTemporaryFile tmp;
+		if( !tmp.open() )
+			throw DatabaseException( DatabaseException::OpenDbFile, "cannot create temporary file" );
+		backup( &tmp, pagesPerStep );
+		tmp.seek( 0 );
+		while( !tmp.atEnd() )
+		{
+			const QByteArray buf = tmp.read( 1 << 20 );
+			if( out->write( buf ) != buf.size() )
+				throw DatabaseException( DatabaseException::AccessDatabase, "cannot write backup" );
+		}
+		return;
+	}
+	QVector<quint64> sums; // Pruefsumme der geschriebenen Pages, Index ist pgno - 1
+	qint64 written = 0;
+	QTime clock;
+	clock.start();
+	for( int pass = 1; pass < s_maxBackupPasses; pass++ )
+	{
+		if( backupPass( out, pagesPerStep, pass, sums, written, clock ) )
+			return;
+	}
+	// Letzter Durchgang unter Lock: Commits warten, bis er fertig ist. Unter ReadLock koennte inzwischen
+	// eine neue Commit-Gruppe offen sein, deren Flush in backupPass dann Lock braeuchte (Deadlock).
+	Lock lock( this );
+	closeCommitGroup( d_groupNr );
+	backupPass( out, pagesPerStep, s_maxBackupPasses, sums, written, clock );
+}
+
+bool Database::backupPass( QIODevice* out, int pagesPerStep, int pass, QVector<quint64>& sums,
+						   qint64& written, const QTime& clock )
+{
+	pagesPerStep = qMax( pagesPerStep, 1 );
+	bool changed = false;
+	quint32 counter0 = 0;
+	quint32 changes0 = 0;
+	quint32 total = 1;
+	int pageSize = 0;
+	QList<QByteArray> pages;
+	quint32 pgno = 1;
+	while( pgno <= total )
+	{
+		bool flush = false;
+		{
+			ReadLock lock( this );
+			checkOpen();
+			if( d_db->isTrans() )
+			{
+				if( d_groupNr == 0 )
+					throw DatabaseException( DatabaseException::StartTrans, "cannot backup within transaction" );
+				flush = true;
+			}else
+			{
+				quint32 counter = 0;
+				total = d_db->readPages( pgno, pagesPerStep, pages, &counter );
+				if( pgno == 1 )
+				{
+					counter0 = counter;
+					changes0 = d_db->getChangeCount();
+				}else if( counter != counter0 || d_db->getChangeCount() != changes0 )
+					changed = true; // weiter kopieren, der naechste Durchgang fuehrt nach
+			}
+		}
+		if( flush )
+		{
+			// Eine offene Commit-Gruppe haelt die Store-Transaktion; sie wird vorzeitig geschrieben
+			Lock lock( this );
+			closeCommitGroup( d_groupNr );
+			continue;
+		}
+		if( sums.size() < int(total) )
+			sums.resize( total );
+		if( !pages.isEmpty() )
+			pageSize = pages.first().size();
+		for( int i = 0; i < pages.size(); i++, pgno++ )
+		{
+			const quint64 h = _pageHash( pages[i] );
+			if( sums[pgno - 1] == h && h != 0 )
+				continue;
+			if( !out->seek( qint64(pgno - 1) * pageSize ) ||
+				out->write( pages[i] ) != pages[i].size() )
+				throw DatabaseException( DatabaseException::AccessDatabase, "cannot write backup" );
+			sums[pgno - 1] = h;
+			written += pages[i].size();
+		}
+		if( pages.isEmpty() )
+			break;
+		emit backupProgress( pass, pgno - 1, total, written * 1000 / qMax( clock.elapsed(), 1 ) );
+	}
+	// Die Datenbank kann inzwischen geschrumpft sein
+	const qint64 size = qint64(total) * pageSize;
+	if( size > 0 )
+	{
+		if( QFile* f = qobject_cast<QFile*>( out ) )
+			f->resize( size );
+		else if( QBuffer* b = qobject_cast<QBuffer*>( out ) )
+			b->buffer().resize( size );
+		sums.resize( total );
+	}
+	return !changed;
+}
+
+bool Database::isInMemory() const
+{
+	checkOpen();
+	Lock lock( const_cast<Database*>(this) );
+	return d_db->isInMemory();
+}
+
+void Database::clearCaches()
+{
+	d_dir.clear();
+	d_invDir.clear();
+	d_idxMeta.clear();
+	d_idxAtoms.clear();
+	d_queueNrs.clear();
+	{
+		QMutexLocker l( &d_fieldLock );
+		d_fieldCache.clear();
+	}
+	QMutexLocker l( &d_uuidLock );
+	d_uuidToOid.clear();
+	d_oidToUuid.clear();
+}
+
+void Database::setAutoVacuum( bool on )
+{
+	Lock lock( this );
+	d_autoVacuum = on;
+}
+
+bool Database::compact( int maxMillis )
+{
+	checkOpen();
+	Lock lock( this );
+	return d_db->incrementalVacuum( maxMillis );
+}
+
+quint32 Database::getFreePageCount() const
+{
+	checkOpen();
+	Lock lock( const_cast<Database*>(this) );
+	return d_db->getFreePageCount();
+}
+
+void Database::setCompactKeys( bool on )
+{
+	Lock lock( this );
+	d_compactKeys = on;
+}
+
+bool Database::hasCompactKeys() const
+{
+	checkOpen();
+	Lock lock( const_cast<Database*>(this) );
+	return d_meta.d_compactKeys;
+}
+
+void Database::setPackedType( Atom type, bool on )
+{
+	checkOpen();
+	TxnGuard lock( this );
+	if( on )
+	{
+		d_meta.d_packedTypes.insert( type );
+		d_meta.d_packed = true; // bleibt, solange es gepackte Zeilen geben koennte
+	}else
+		d_meta.d_packedTypes.remove( type );
+	d_db->setPackedRecords( d_meta.d_packed );
+	saveMeta();
+}
+
+bool Database::isPackedType( Atom type ) const
+{
+	Lock lock( const_cast<Database*>(this) );
+	return d_meta.d_packedTypes.contains( type );
+}
+
+int Database::packObjects( Atom type )
+{
+	checkOpen();
+	TxnGuard lock( this );
+	if( d_db->isReadOnly() )
+		return 0;
+	const bool pack = d_meta.d_packedTypes.contains( type );
+	// Zuerst die OIDs aus dem Objektverzeichnis sammeln; Umbauen waehrend des Durchgangs wuerde
+	// den Cursor verschieben
+	QList<OID> oids;
+	BtreeCursor ext;
+	ext.open( d_db, getExtTable(), false );
+	if( ext.moveFirst() ) do
+	{
+		DataCell t;
+		t.readCell( ext.readValue() );
+		if( t.getAtom() != type )
+			continue;
+		DataCell k;
+		k.readCell( ext.readKey() );
+		oids.append( k.getOid() );
+	}while( ext.moveNext() );
+	BtreeCursor cur;
+	cur.open( d_db, getObjTable(), true );
+	int n = 0;
+	for( int i = 0; i < oids.size(); i++ )
+	{
+		if( ( pack )? Record::packFields( cur, oids[i] ) : Record::unpackFields( cur, oids[i] ) )
+			n++;
+	}
+	return n;
+}
+
+void Database::setRecycleOids( bool on )
+{
+	Lock lock( this );
+	d_recycleOids = on;
+}
+
+void Database::setOidBlockSize( quint32 n )
+{
+	Lock lock( this );
+	d_oidBlock = qMax( n, quint32(1) );
+}
+
 void Database::setCacheSize( int numOfPages )
 {
 	checkOpen();
@@ -150,14 +581,313 @@ void Database::setCacheSize( int numOfPages )
 	d_db->setCacheSize( numOfPages );
 }
 
+void Database::setCacheMemory( qint64 bytes )
+{
+	Lock lock( this );
+	d_cacheMem = bytes;
+	if( d_db )
+		d_db->setCacheMemory( bytes );
+}
+
+void Database::setFieldCacheMemory( qint64 bytes )
+{
+	Lock lock( this );
+	QMutexLocker l( &d_fieldLock );
+	d_fieldCache.setMaxCost( int( qBound( qint64(0), bytes, qint64(INT_MAX) ) ) );
+}
+
+Database::FieldCacheStats Database::getFieldCacheStats() const
+{
+	QMutexLocker l( &d_fieldLock );
+	FieldCacheStats s;
+	s.d_hits = d_fieldHits;
+	s.d_misses = d_fieldMisses;
+	s.d_invalidations = d_fieldInvalidations;
+	s.d_entries = d_fieldCache.count();
+	s.d_cost = d_fieldCache.totalCost();
+	s.d_maxCost = d_fieldCache.maxCost();
+	return s;
+}
+
+bool Database::getCachedField( OID oid, Atom a, Stream::DataCell& v ) const
+{
+	QMutexLocker l( &d_fieldLock );
+	if( d_fieldCache.maxCost() == 0 )
+		return false;
+	checkFieldAborts();
+	const Stream::DataCell* c = d_fieldCache.object( qMakePair( OID(oid), a ) ); // macht Eintrag zum juengsten
+	if( c == 0 )
+	{
+		d_fieldMisses++;
+		return false;
+	}
+	d_fieldHits++;
+	v = *c;
+	return true;
+}
+
+void Database::cacheField( OID oid, Atom a, const Stream::DataCell& v, int bytes ) const
+{
+	QMutexLocker l( &d_fieldLock );
+	if( d_fieldCache.maxCost() == 0 )
+		return;
+	checkFieldAborts();
+	// Kosten: Cell im Store plus Verwaltung; auch Null wird gecacht (Feld nicht vorhanden)
+	d_fieldCache.insert( qMakePair( OID(oid), a ), new Stream::DataCell( v ), bytes + 48 );
+}
+
+void Database::checkFieldAborts() const
+{
+	// Gelesen wird auch innerhalb offener Store-Transaktionen (TxnGuard, Commit-Gruppe); nach einem
+	// transAbort koennen Eintraege zurueckgerollte Werte enthalten und werden alle verworfen.
+	if( d_db != 0 && d_db->getAbortCount() != d_fieldAborts )
+	{
+		d_fieldCache.clear();
+		d_fieldAborts = d_db->getAbortCount();
+	}
+}
+
+void Database::uncacheField( OID oid, Atom a )
+{
+	QMutexLocker l( &d_fieldLock );
+	checkFieldAborts();
+	if( d_fieldCache.remove( qMakePair( OID(oid), a ) ) )
+		d_fieldInvalidations++;
+}
+
+void Database::setUuidCacheSize( int entries )
+{
+	Lock lock( this );
+	QMutexLocker l( &d_uuidLock );
+	d_uuidToOid.setMaxCost( qMax( entries, 0 ) );
+	d_oidToUuid.setMaxCost( qMax( entries, 0 ) );
+}
+
+OID Database::getCachedOid( const QUuid& uuid ) const
+{
+	QMutexLocker l( &d_uuidLock );
+	if( d_uuidToOid.maxCost() == 0 )
+		return 0;
+	checkUuidAborts();
+	const OID* oid = d_uuidToOid.object( DataCell().setUuid( uuid ).writeCell() );
+	return ( oid )? *oid : 0;
+}
+
+QUuid Database::getCachedUuid( OID oid ) const
+{
+	QMutexLocker l( &d_uuidLock );
+	if( d_oidToUuid.maxCost() == 0 )
+		return QUuid();
+	checkUuidAborts();
+	const QUuid* uuid = d_oidToUuid.object( oid );
+	return ( uuid )? *uuid : QUuid();
+}
+
+void Database::checkUuidAborts() const
+{
+	// Wie checkFieldAborts: Paare aus zurueckgerollten Store-Transaktionen verwerfen
+	if( d_db != 0 && d_db->getAbortCount() != d_uuidAborts )
+	{
+		d_uuidToOid.clear();
+		d_oidToUuid.clear();
+		d_uuidAborts = d_db->getAbortCount();
+	}
+}
+
+void Database::cacheUuid( const QUuid& uuid, OID oid ) const
+{
+	QMutexLocker l( &d_uuidLock );
+	if( d_uuidToOid.maxCost() == 0 || uuid.isNull() || oid == 0 )
+		return;
+	checkUuidAborts();
+	// Beide Richtungen werden unabhaengig verdraengt; uncacheUuid liest darum die alte Uuid aus dem Store
+	d_uuidToOid.insert( DataCell().setUuid( uuid ).writeCell(), new OID( oid ) );
+	d_oidToUuid.insert( oid, new QUuid( uuid ) );
+}
+
+void Database::uncacheUuid( OID oid, BtreeCursor& objCur )
+{
+	{
+		QMutexLocker l( &d_uuidLock );
+		if( d_uuidToOid.maxCost() == 0 )
+			return;
+	}
+	const QUuid old = Record::getUuid( objCur, oid ); // ausserhalb d_uuidLock
+	QMutexLocker l( &d_uuidLock );
+	checkUuidAborts();
+	if( !old.isNull() )
+		d_uuidToOid.remove( DataCell().setUuid( old ).writeCell() );
+	d_oidToUuid.remove( oid );
+}
+
+void Database::setGroupCommit( int maxTxns, int windowMs )
+{
+	Lock lock( this );
+	if( maxTxns <= 1 )
+		closeCommitGroup( d_groupNr );
+	d_groupMax = maxTxns;
+	d_groupWindow = qMax( windowMs, 0 );
+}
+
+void Database::flushGroupCommit()
+{
+	Lock lock( this );
+	closeCommitGroup( d_groupNr );
+}
+
+quint32 Database::joinCommitGroup()
+{
+	// NOTE: Caller ist fuer Database::Lock verantwortlich
+	if( d_groupMax <= 1 )
+		return 0;
+	QMutexLocker l( &d_groupLock );
+	if( d_groupNr != 0 && d_groupAborts != d_db->getAbortCount() )
+	{
+		// Die gemeinsame Store-Transaktion wurde inzwischen zurueckgerollt (z.B. TxnGuard::rollback);
+		// spaetere Mitglieder beginnen eine neue Gruppe
+		failCommitGroup( d_groupNr, d_groupCount, "commit group was rolled back" );
+	}
+	if( d_groupNr == 0 )
+	{
+		// Die Store-Transaktion bleibt offen, bis die Gruppe abgeschlossen wird; die WriteLocks
+		// der einzelnen Commits sind darin verschachtelt und loesen keinen Sync aus.
+		BtreeStore::ReadLock store( d_db );
+		d_db->transBegin();
+		d_groupAborts = d_db->getAbortCount();
+		d_groupNr = ++d_groupSeq;
+		d_groupCount = 0;
+		d_groupStart.start();
+	}
+	d_groupCount++;
+	return d_groupNr;
+}
+
+void Database::closeCommitGroup( quint32 group )
+{
+	// NOTE: Caller ist fuer Database::Lock verantwortlich
+	QMutexLocker l( &d_groupLock );
+	if( group == 0 || d_groupNr != group )
+		return; // bereits abgeschlossen
+	if( d_groupAborts != d_db->getAbortCount() )
+	{
+		// Schreibvorgaenge der Mitglieder sind verloren; transCommit waere hier wirkungslos
+		failCommitGroup( group, d_groupCount, "commit group was rolled back" );
+		return;
+	}
+	d_groupNr = 0;
+	try
+	{
+		BtreeStore::ReadLock store( d_db );
+		d_db->transCommit();
+	}catch( const DatabaseException& e )
+	{
+		d_db->transAbort();
+		d_groupErrors[group] = qMakePair( d_groupCount, e.getMsg() );
+	}
+	d_groupClosed = group;
+	d_groupDone.wakeAll();
+}
+
+void Database::abortCommitGroup( quint32 group, const QString& msg )
+{
+	// NOTE: Caller ist fuer Database::Lock verantwortlich
+	QMutexLocker l( &d_groupLock );
+	if( group == 0 || d_groupNr != group )
+		return;
+	if( d_groupAborts == d_db->getAbortCount() )
+	{
+		BtreeStore::ReadLock store( d_db );
+		d_db->transAbort();
+	}
+	// Das scheiternde Mitglied wartet nicht, es erhaelt die Exception direkt
+	failCommitGroup( group, d_groupCount - 1, msg );
+}
+
+void Database::failCommitGroup( quint32 group, int members, const QString& msg )
+{
+	// NOTE: Caller haelt d_groupLock
+	if( members > 0 )
+		d_groupErrors[group] = qMakePair( members, msg );
+	d_groupNr = 0;
+	d_groupClosed = group;
+	d_groupDone.wakeAll();
+}
+
+void Database::waitCommitGroup( quint32 group )
+{
+	// NOTE: Caller haelt weder Lock noch ReadLock, ausser verschachtelt von aussen
+	QMutexLocker l( &d_groupLock );
+	while( d_groupClosed < group )
+	{
+		const int rest = d_groupWindow - d_groupStart.elapsed();
+		if( d_groupCount >= d_groupMax || rest <= 0 )
+		{
+			// Wer die volle oder abgelaufene Gruppe zuerst bemerkt, schreibt sie. Damit kommt
+			// die Gruppe auch dann zum Abschluss, wenn ein Mitglied von aussen Lock haelt.
+			l.unlock();
+			{
+				Lock lock( this );
+				closeCommitGroup( group );
+			}
+			l.relock();
+		}else
+			d_groupDone.wait( &d_groupLock, rest );
+	}
+	QHash<quint32, QPair<int,QString> >::iterator i = d_groupErrors.find( group );
+	if( i != d_groupErrors.end() )
+	{
+		const QString msg = i.value().second;
+		if( --i.value().first <= 0 )
+			d_groupErrors.erase( i );
+		throw DatabaseException( DatabaseException::CommitTrans, msg );
+	}
+}
+
+void Database::enqueueWrite( Transaction* txn )
+{
+#ifndef DATABASE_HAS_MUTEX
+	Q_ASSERT_X( false, "Database::enqueueWrite", "writer thread requires DATABASE_HAS_MUTEX" );
+#endif
+	Lock lock( this );
+	if( d_writer == 0 )
+	{
+		d_writer = new AsyncWriter();
+		d_writer->start();
+	}
+	d_writer->enqueue( txn );
+}
+
+void Database::stopWriter()
+{
+	// Ohne Lock, da der Writer-Thread ihn zum Schreiben braucht
+	AsyncWriter* w = 0;
+	{
+		Lock lock( this );
+		w = d_writer;
+		d_writer = 0;
+	}
+	if( w )
+	{
+		w->stop();
+		delete w;
+	}
+}
+
 void Database::close()
 {
+	stopWriter();
 	Lock lock( this );
+	if( d_db )
+	{
+		closeCommitGroup( d_groupNr );
+		releaseOids();
+	}
 	emit notify( UpdateInfo( UpdateInfo::DbClosing ) );
 	if( d_db )
 		delete d_db;
 	d_db = 0;
 	d_meta = Meta();
+	clearCaches();
 	// TODO: d_cache + Records lschen
 }
 
@@ -190,6 +920,22 @@ void Database::loadMeta()
 					d_meta.d_mapTable = value.getInt32();
                 else if( name == "oixTable" )
 					d_meta.d_oixTable = value.getInt32();
+				else if( name == "extTable" )
+					d_meta.d_extTable = value.getInt32();
+				else if( name == "typTable" )
+					d_meta.d_typTable = value.getInt32();
+				else if( name == "pageSize" )
+				{
+					d_meta.d_pageSize = value.getInt32();
+					if( d_meta.d_pageSize != d_db->getPageSize() )
+						throw DatabaseException( DatabaseException::DatabaseMeta, "page size mismatch" );
+				}
+				else if( name == "keyFormat" )
+					d_meta.d_compactKeys = value.getInt32() == 1;
+				else if( name == "packed" )
+					d_meta.d_packed = value.getInt32() == 1;
+				else if( name == "packedType" )
+					d_meta.d_packedTypes.insert( value.getAtom() );
 				else if( name == "dbFormat" )
 				{
 					QUuid uuid( s_dbFormat );
@@ -206,6 +952,116 @@ void Database::loadMeta()
 	}
 	if( !empty && !formatSeen )
 		throw DatabaseException( DatabaseException::DatabaseFormat );
+	if( d_meta.d_objTable == 0 )
+		d_meta.d_compactKeys = d_compactKeys; // noch keine Records, Format ist noch frei
+	d_db->setCompactKeys( d_meta.d_compactKeys );
+	d_db->setPackedRecords( d_meta.d_packed );
+	const bool extent = d_meta.d_objTable != 0 && ( d_meta.d_extTable == 0 || d_meta.d_typTable == 0 ) &&
+		!d_db->isReadOnly(); // aeltere Datei ohne Objektverzeichnis bzw. Typ-Index
+	if( !d_db->isReadOnly() )
+		createTables();
+	if( extent )
+		buildExtent();
+}
+
+void Database::createTables()
+{
+	// NOTE: Caller ist fuer Lock verantwortlich
+	// Alle Tabellen gleich beim Oeffnen anlegen; Leser unter ReadLock erzeugen so nie Tabellen
+	// oder schreiben Meta, waehrend andere Leser Cursor offen haben.
+	int* tables[] = { &d_meta.d_objTable, &d_meta.d_dirTable, &d_meta.d_idxTable, &d_meta.d_queTable,
+					  &d_meta.d_mapTable, &d_meta.d_oixTable, &d_meta.d_extTable, &d_meta.d_typTable };
+	BtreeStore::WriteLock txn( d_db );
+	bool created = false;
+	for( size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++ )
+	{
+		if( *tables[i] == 0 )
+		{
+			*tables[i] = d_db->createTable();
+			created = true;
+		}
+	}
+	if( created )
+		saveMeta();
+}
+
+void Database::buildExtent()
+{
+	// NOTE: Caller ist fuer Lock verantwortlich
+	// Einmaliger Durchgang durch alle Records; danach fuehrt Transaction::writeChanges das Verzeichnis nach
+	BtreeStore::WriteLock lock( d_db );
+	BtreeCursor ext;
+	ext.open( d_db, getTable( d_meta.d_extTable ), true );
+	BtreeCursor typ;
+	typ.open( d_db, getTable( d_meta.d_typTable ), true );
+	QHash<Atom,quint32> counts;
+	BtreeCursor cur;
+	cur.open( d_db, getObjTable(), false );
+	BtreeCursor rec;
+	rec.open( d_db, getObjTable(), false );
+	OID last = 0;
+	if( cur.moveFirst() ) do
+	{
+		int len;
+		const char* key = cur.fetchKey( len );
+		DataCell k;
+		k.readCell( QByteArray::fromRawData( key, len ) ); // nur erste Cell
+		if( k.isOid() && k.getOid() != last )
+		{
+			last = k.getOid();
+			DataCell type;
+			Record::readField( rec, last, Record::FieldType, type );
+			ext.insertSorted( k.writeCell(), type.writeCell() );
+			if( type.getAtom() != 0 )
+			{
+				typ.insert( DataCell().setAtom( type.getAtom() ).writeCell() + k.writeCell(), QByteArray() );
+				counts[type.getAtom()]++;
+			}
+		}
+	}while( cur.moveNext() );
+	QHash<Atom,quint32>::const_iterator i;
+	for( i = counts.begin(); i != counts.end(); ++i )
+		typ.insert( DataCell().setAtom( i.key() ).writeCell(), DataCell().setId32( i.value() ).writeCell() );
+}
+
+quint32 Database::getTypeCount( Atom type )
+{
+	checkOpen();
+	ReadLock lock( this );
+	const int table = getTypTable();
+	if( table != 0 )
+	{
+		BtreeCursor cur;
+		cur.open( d_db, table, false );
+		if( !cur.moveTo( DataCell().setAtom( type ).writeCell() ) )
+			return 0;
+		DataCell v;
+		v.readCell( cur.readValue() );
+		return v.getId32();
+	}
+	// Aeltere Datei nur lesend offen; Typ jedes Objekts lesen
+	BtreeCursor cur;
+	cur.open( d_db, getObjTable(), false );
+	BtreeCursor rec;
+	rec.open( d_db, getObjTable(), false );
+	quint32 n = 0;
+	OID last = 0;
+	if( cur.moveFirst() ) do
+	{
+		int len;
+		const char* key = cur.fetchKey( len );
+		DataCell k;
+		k.readCell( QByteArray::fromRawData( key, len ) ); // nur erste Cell
+		if( k.isOid() && k.getOid() != last )
+		{
+			last = k.getOid();
+			DataCell t;
+			Record::readField( rec, last, Record::FieldType, t );
+			if( t.getAtom() == type )
+				n++;
+		}
+	}while( cur.moveNext() );
+	return n;
 }
 
 void Database::saveMeta()
@@ -220,6 +1076,14 @@ void Database::saveMeta()
 	value.writeSlot( DataCell().setInt32( d_meta.d_queTable ), "queTable" );
 	value.writeSlot( DataCell().setInt32( d_meta.d_mapTable ), "mapTable" );
     value.writeSlot( DataCell().setInt32( d_meta.d_oixTable ), "oixTable" );
+	value.writeSlot( DataCell().setInt32( d_meta.d_extTable ), "extTable" );
+	value.writeSlot( DataCell().setInt32( d_meta.d_typTable ), "typTable" );
+	d_meta.d_pageSize = d_db->getPageSize();
+	value.writeSlot( DataCell().setInt32( d_meta.d_pageSize ), "pageSize" );
+	value.writeSlot( DataCell().setInt32( d_meta.d_compactKeys ? 1 : 0 ), "keyFormat" );
+	value.writeSlot( DataCell().setInt32( d_meta.d_packed ? 1 : 0 ), "packed" );
+	foreach( Atom type, d_meta.d_packedTypes )
+		value.writeSlot( DataCell().setAtom( type ), "packedType" );
 	value.writeSlot( DataCell().setUuid( s_dbFormat ), "dbFormat" );
 	meta.write( DataCell().setNull().writeCell(), value.getStream() );
 }
@@ -230,76 +1094,57 @@ void Database::checkOpen() const
 		throw DatabaseException( DatabaseException::AccessDatabase, "database not open" );
 }
 
-int Database::getObjTable()
+int Database::getTable( int& table )
 {
 	checkOpen();
-	if( d_meta.d_objTable == 0 )
-	{
-		BtreeStore::WriteLock txn( d_db );
-		d_meta.d_objTable = d_db->createTable();
-		saveMeta();
-	}
-	return d_meta.d_objTable;
+	if( table == 0 )
+		// loadMeta legt alle Tabellen an; fehlen kann eine nur in einer nur lesend geoeffneten Datei
+		throw DatabaseException( DatabaseException::AccessMeta, "table missing in read-only database" );
+	return table;
+}
+
+int Database::getObjTable()
+{
+	return getTable( d_meta.d_objTable );
 }
 
 int Database::getDirTable()
 {
-	checkOpen();
-	if( d_meta.d_dirTable == 0 )
-	{
-		BtreeStore::WriteLock txn( d_db );
-		d_meta.d_dirTable = d_db->createTable();
-		saveMeta();
-	}
-	return d_meta.d_dirTable;
+	return getTable( d_meta.d_dirTable );
 }
 
 int Database::getQueTable()
 {
-	checkOpen();
-	if( d_meta.d_queTable == 0 )
-	{
-		BtreeStore::WriteLock txn( d_db );
-		d_meta.d_queTable = d_db->createTable();
-		saveMeta();
-	}
-	return d_meta.d_queTable;
+	return getTable( d_meta.d_queTable );
 }
 
 int Database::getIdxTable()
 {
-	checkOpen();
-	if( d_meta.d_idxTable == 0 )
-	{
-		BtreeStore::ReadLock txn( d_db );
-		d_meta.d_idxTable = d_db->createTable();
-		saveMeta();
-	}
-	return d_meta.d_idxTable;
+	return getTable( d_meta.d_idxTable );
 }
 
 int Database::getMapTable()
 {
-	checkOpen();
-	if( d_meta.d_mapTable == 0 )
-	{
-		BtreeStore::ReadLock txn( d_db );
-		d_meta.d_mapTable = d_db->createTable();
-		saveMeta();
-	}
-	return d_meta.d_mapTable;
+	return getTable( d_meta.d_mapTable );
 }
 
 int Database::getOixTable()
 {
-	checkOpen();
-	if( d_meta.d_oixTable == 0 )
-	{
-		BtreeStore::ReadLock txn( d_db );
-		d_meta.d_oixTable = d_db->createTable();
-		saveMeta();
-	}
-	return d_meta.d_oixTable;
+	return getTable( d_meta.d_oixTable );
+}
+
+int Database::getExtTable()
+{
+	if( d_meta.d_extTable == 0 && d_db->isReadOnly() )
+		return 0;
+	return getTable( d_meta.d_extTable );
+}
+
+int Database::getTypTable()
+{
+	if( d_meta.d_typTable == 0 && d_db->isReadOnly() )
+		return 0;
+	return getTable( d_meta.d_typTable );
 }
 
 QByteArray Database::getAtomString( quint32 a )
@@ -307,7 +1152,8 @@ QByteArray Database::getAtomString( quint32 a )
 	if( a == 0 )
 		return QByteArray();
 #ifdef DATABASE_HAS_MUTEX
-	QMutexLocker lock( &d_lock );
+	ReadLock lock( this ); // auch unter ReadLock des Aufrufers; d_atomLock schuetzt den Cache
+	QMutexLocker atoms( &d_atomLock );
 #endif
 	QHash<quint32,QByteArray>::const_iterator i = d_invDir.find( a );
 	if( i != d_invDir.end() )
@@ -325,32 +1171,50 @@ QByteArray Database::getAtomString( quint32 a )
 		return QByteArray();
 }
 
-quint32 Database::getAtom( const QByteArray& name )
+quint32 Database::findAtom( const QByteArray& name )
 {
-#ifdef DATABASE_HAS_MUTEX
-	QMutexLocker lock( &d_lock );
-#endif
+	// NOTE: Caller ist fuer ReadLock oder Lock und fuer d_atomLock verantwortlich
 	QHash<QByteArray,quint32>::const_iterator i = d_dir.find( name );
 	if( i != d_dir.end() )
 		return i.value();
-	const QByteArray n = DataCell().setLatin1(name).writeCell();
-	// Suche Atom in Db
+	BtreeCursor cur;
+	cur.open( d_db, getDirTable(), false );
+	if( cur.moveTo( DataCell().setLatin1(name).writeCell() ) )
 	{
-		BtreeCursor cur;
-		cur.open( d_db, getDirTable(), false );
-		if( cur.moveTo( n ) )
-		{
-			DataCell atom;
-			atom.readCell( cur.readValue() );
-			if( atom.getType() != DataCell::TypeAtom )
-				throw DatabaseException( DatabaseException::DirectoryFormat );
-			d_dir[name] = atom.getAtom();
-			d_invDir[atom.getAtom()] = name;
-			return atom.getAtom();
-		}
+		DataCell atom;
+		atom.readCell( cur.readValue() );
+		if( atom.getType() != DataCell::TypeAtom )
+			throw DatabaseException( DatabaseException::DirectoryFormat );
+		d_dir[name] = atom.getAtom();
+		d_invDir[atom.getAtom()] = name;
+		return atom.getAtom();
 	}
-	// Atom existiert noch nicht, erzeuge es
-	if( !d_db->isReadOnly() )
+	return 0;
+}
+
+quint32 Database::getAtom( const QByteArray& name )
+{
+	{
+#ifdef DATABASE_HAS_MUTEX
+		ReadLock lock( this ); // auch unter ReadLock des Aufrufers; d_atomLock schuetzt den Cache
+		QMutexLocker atoms( &d_atomLock );
+#endif
+		const quint32 atom = findAtom( name );
+		if( atom != 0 || d_db->isReadOnly() )
+			return atom;
+	}
+	// Atom existiert noch nicht, erzeuge es. Geschrieben wird nur unter Lock, damit kein Leser einen
+	// Cursor offen hat; der Aufrufer darf darum hier keinen ReadLock halten.
+	Lock lock( this );
+#ifdef DATABASE_HAS_MUTEX
+	QMutexLocker atoms( &d_atomLock );
+#endif
+	{
+		const quint32 atom = findAtom( name ); // inzwischen von einem anderen Thread erzeugt
+		if( atom != 0 )
+			return atom;
+	}
+	const QByteArray n = DataCell().setLatin1(name).writeCell();
 	{
 		BtreeStore::WriteLock txn( d_db );
 		BtreeCursor cur;
@@ -373,16 +1237,17 @@ quint32 Database::getAtom( const QByteArray& name )
 		d_dir[name] = atom;
 		d_invDir[atom] = name; // name wird nur einmal gespeichert
 		return atom;
-	}else
-		return 0;
+	}
 }
 
 void Database::presetAtom( const QByteArray& name, quint32 atom )
 {
 	checkOpen();
-	// Suche den Wert im Cache und in der DB
+	// Suche den Wert im Cache und in der DB. Unter Lock, da ein neues Atom geschrieben wird;
+	// der Aufrufer darf keinen ReadLock halten.
+	Lock lock( this );
 #ifdef DATABASE_HAS_MUTEX
-	QMutexLocker lock( &d_lock );
+	QMutexLocker atoms( &d_atomLock );
 #endif
 	QHash<QByteArray,quint32>::const_iterator i = d_dir.find( name );
 	if( i != d_dir.end() )
@@ -456,7 +1321,21 @@ OID Database::getMaxOid()
 
 OID Database::getNextOid(bool persistent)
 {
+	// NOTE: Caller ist fuer Lock verantwortlich
 	checkOpen();
+	if( d_oidLimit != 0 && d_oidAborts != d_db->getAbortCount() )
+	{
+		// Die Reservation wurde evtl. mit einer aeusseren Transaktion zurueckgerollt; Rest verwerfen
+		d_oidNext = d_oidLimit = 0;
+		d_oidFree = true;
+	}
+	if( d_oidNext != 0 && d_oidNext <= d_oidLimit && !( persistent && d_recycleOids && d_oidFree ) )
+	{
+		// Aus dem reservierten Block, ohne Zugriff auf den Store
+		if( !persistent )
+			return d_oidNext;
+		return d_oidNext++;
+	}
 	OID id = 0;
 	BtreeStore::WriteLock lock( d_db );
 	BtreeCursor cur;
@@ -467,19 +1346,92 @@ OID Database::getNextOid(bool persistent)
 		v.readCell( cur.readValue() );
 		id = v.getOid();
 	}
+	if( persistent && d_recycleOids && !d_db->isReadOnly() )
+	{
+		// Freelist: <null><oid> -> leer, direkt nach dem Zaehler <null>
+		const QByteArray null = DataCell().setNull().writeCell();
+		if( cur.moveNext( null ) )
+		{
+			DataCell free;
+			free.readCell( cur.readKey().mid( null.size() ) );
+			cur.removePos();
+			if( free.isOid() )
+				return free.getOid();
+		}
+		d_oidFree = false;
+	}
+	if( d_oidNext != 0 && d_oidNext <= d_oidLimit )
+		return ( persistent )? d_oidNext++ : d_oidNext; // Freelist war leer
 	id++;
-	if( id == 0xffffffff )
-		throw DatabaseException( DatabaseException::OidOutOfRange ); // RISK: zur Zeit nur auf 32 Bit ausgelegt
+	const OID max = Q_UINT64_C(0xffffffffffffffff);
+	if( id == max )
+		throw DatabaseException( DatabaseException::OidOutOfRange ); // Zelle ist Multibyte64, Zaehler laeuft ueber 2^32 hinaus
 	if( persistent && !d_db->isReadOnly() )
-		cur.insert( DataCell().setNull().writeCell(), DataCell().setOid( id ).writeCell() );
+	{
+		// Zaehler in der Datei = letzte reservierte OID
+		OID limit = id + ( d_oidBlock - 1 );
+		if( limit < id || limit == max )
+			limit = max - 1;
+		cur.insert( DataCell().setNull().writeCell(), DataCell().setOid( limit ).writeCell() );
+		d_oidNext = id + 1;
+		d_oidLimit = limit;
+		d_oidAborts = d_db->getAbortCount();
+	}
 	return id;
 }
 
+void Database::releaseOids()
+{
+	// NOTE: Caller ist fuer Lock verantwortlich
+	// Gibt den unverbrauchten Rest des Blocks zurueck, sofern der Zaehler noch auf unserem Limit steht
+	if( d_db != 0 && !d_db->isReadOnly() && d_oidNext != 0 && d_oidNext <= d_oidLimit &&
+		d_oidAborts == d_db->getAbortCount() )
+	{
+		try
+		{
+			BtreeStore::WriteLock lock( d_db );
+			BtreeCursor cur;
+			cur.open( d_db, getObjTable(), true );
+			const QByteArray null = DataCell().setNull().writeCell();
+			if( cur.moveTo( null ) )
+			{
+				DataCell v;
+				v.readCell( cur.readValue() );
+				if( v.getOid() == d_oidLimit )
+					cur.insert( null, DataCell().setOid( d_oidNext - 1 ).writeCell() );
+			}
+		}catch( ... )
+		{
+			// Rest bleibt als Luecke
+		}
+	}
+	d_oidNext = d_oidLimit = 0;
+	d_oidFree = true;
+}
+
+void Database::freeOid( OID oid, BtreeCursor& objCur )
+{
+	// NOTE: Caller ist fuer Lock und BtreeStore::WriteLock verantwortlich
+	if( !d_recycleOids || d_db->isReadOnly() )
+		return;
+	objCur.insert( DataCell().setNull().writeCell() + DataCell().setOid( oid ).writeCell(), QByteArray() );
+	d_oidFree = true;
+}
+
 quint32 Database::getNextQueueNr( OID oid )
 {
+	// NOTE: Caller ist fuer Lock verantwortlich
 	checkOpen();
+	QHash<OID,QueueNrs>::iterator i = d_queueNrs.find( oid );
+	if( i != d_queueNrs.end() && i.value().d_aborts == d_db->getAbortCount() &&
+		i.value().d_next <= i.value().d_limit )
+		// Aus dem reservierten Block, ohne Zugriff auf den Store
+		return i.value().d_next++;
+	// Wie bei getNextOid wird ein Block reserviert und der Zaehler <oid> sofort auf dessen Ende
+	// gesetzt; andere Database-Instanzen und Prozesse setzen darum danach fort.
+	// Nummern verworfener Transaktionen und unverbrauchte Reste bleiben als Luecke.
 	quint32 id = 0;
-	BtreeStore::WriteLock txn( d_db );
+	BtreeStore::WriteLock lock( d_db );
 	BtreeCursor cur;
 	cur.open( d_db, getQueTable(), !d_db->isReadOnly() );
 	const QByteArray key = DataCell().setOid(oid).writeCell();
@@ -489,12 +1441,171 @@ quint32 Database::getNextQueueNr( OID oid )
 		v.readCell( cur.readValue() );
 		id = v.getId32();
 	}
+	if( id == 0xffffffff )
+		throw DatabaseException( DatabaseException::OidOutOfRange, "queue numbers exhausted" );
 	id++;
+	quint32 limit = id + ( s_queueBlock - 1 );
+	if( limit < id )
+		limit = 0xffffffff;
 	if( !d_db->isReadOnly() )
-		cur.insert( key, DataCell().setId32( id ).writeCell() );
+		cur.insert( key, DataCell().setId32( limit ).writeCell() );
+	QueueNrs nrs;
+	nrs.d_next = id + 1;
+	nrs.d_limit = limit;
+	nrs.d_aborts = d_db->getAbortCount();
+	d_queueNrs[oid] = nrs;
 	return id;
 }
 
+typedef QMultiMap<quint64,QPair<OID,quint32> > _Largest; // Bytes -> oid, Anzahl Felder
+
+static void _addLargest( _Largest& top, int max, OID oid, quint64 bytes, quint32 fields )
+{
+	if( oid == 0 || max <= 0 )
+		return;
+	if( top.size() >= max )
+	{
+		if( bytes <= top.begin().key() )
+			return;
+		top.erase( top.begin() );
+	}
+	top.insert( bytes, qMakePair( oid, fields ) );
+}
+
+Database::StorageReport Database::analyzeStorage( int largest )
+{
+	checkOpen();
+	Lock lock( this );
+	StorageReport r;
+	r.d_pageSize = d_db->getPageSize();
+	r.d_freePages = d_db->getFreePageCount();
+
+	QList<QPair<QString,int> > tables;
+	tables.append( qMakePair( QString( "meta" ), d_db->getMetaTable() ) );
+	tables.append( qMakePair( QString( "objTable" ), d_meta.d_objTable ) );
+	tables.append( qMakePair( QString( "dirTable" ), d_meta.d_dirTable ) );
+	tables.append( qMakePair( QString( "idxTable" ), d_meta.d_idxTable ) );
+	tables.append( qMakePair( QString( "queTable" ), d_meta.d_queTable ) );
+	tables.append( qMakePair( QString( "mapTable" ), d_meta.d_mapTable ) );
+	tables.append( qMakePair( QString( "oixTable" ), d_meta.d_oixTable ) );
+	tables.append( qMakePair( QString( "extTable" ), d_meta.d_extTable ) );
+	tables.append( qMakePair( QString( "typTable" ), d_meta.d_typTable ) );
+	if( d_meta.d_idxTable )
+	{
+		// <name> -> <tableId>
+		BtreeCursor cur;
+		cur.open( d_db, d_meta.d_idxTable, false );
+		if( cur.moveFirst() ) do
+		{
+			DataCell k;
+			k.readCell( cur.readKey() );
+			if( k.getType() == DataCell::TypeLatin1 )
+			{
+				DataCell id;
+				id.readCell( cur.readValue() );
+				tables.append( qMakePair( QString( "index %1" ).arg( QString::fromLatin1( k.getArr() ) ),
+										  int( id.getId32() ) ) );
+			}
+		}while( cur.moveNext() );
+	}
+	QSet<quint32> visited;
+	for( int i = 0; i < tables.size(); i++ )
+	{
+		if( tables[i].second == 0 )
+			continue; // noch nicht angelegt
+		TableReport t;
+		t.d_name = tables[i].first;
+		t.d_stats = d_db->analyzeTable( tables[i].second, &visited );
+		r.d_tables.append( t );
+	}
+	// Globals sind nirgends verzeichnet; ihre Roots bleiben uebrig
+	const QList<int> other = d_db->findOtherRoots( visited );
+	for( int i = 0; i < other.size(); i++ )
+	{
+		TableReport t;
+		t.d_name = QString( "global %1" ).arg( other[i] );
+		t.d_stats = d_db->analyzeTable( other[i], &visited );
+		r.d_tables.append( t );
+	}
+	r.d_pageCount = d_db->getPageCount();
+
+	if( d_meta.d_objTable && largest > 0 )
+	{
+		_Largest top;
+		BtreeCursor cur;
+		cur.open( d_db, d_meta.d_objTable, false );
+		OID oid = 0;
+		int oidLen = 0;
+		quint64 bytes = 0;
+		quint32 fields = 0;
+		if( cur.moveFirst() ) do
+		{
+			int klen, vlen;
+			const char* key = cur.fetchKey( klen );
+			DataCell k;
+			k.readCell( QByteArray::fromRawData( key, klen ) ); // nur erste Cell
+			if( !k.isOid() )
+				continue; // <uuid>, <null>
+			if( k.getOid() != oid )
+			{
+				_addLargest( top, largest, oid, bytes, fields );
+				oid = k.getOid();
+				oidLen = k.writeCell().size();
+				bytes = 0;
+				fields = 0;
+			}
+			cur.fetchValue( vlen );
+			bytes += klen + vlen;
+			if( klen > oidLen )
+				fields++;
+		}while( cur.moveNext() );
+		_addLargest( top, largest, oid, bytes, fields );
+		_Largest::const_iterator i = top.constEnd();
+		while( i != top.constBegin() )
+		{
+			--i;
+			ObjectReport o;
+			o.d_oid = i.value().first;
+			o.d_bytes = i.key();
+			o.d_fields = i.value().second;
+			DataCell type;
+			Record::readField( cur, o.d_oid, Record::FieldType, type );
+			o.d_type = type.getAtom();
+			r.d_largest.append( o );
+		}
+	}
+	return r;
+}
+
+static void _printHistogram( QTextStream& out, const char* title, const QVector<quint64>& h )
+{
+	out << "    " << title << ":";
+	for( int i = 0; i < h.size(); i++ )
+		if( h[i] )
+			out << " <" << ( quint64(1) << i ) << ":" << h[i];
+	out << endl;
+}
+
+void Database::printStorageReport( const StorageReport& r, QTextStream& out )
+{
+	out << "page size " << r.d_pageSize << ", pages " << r.d_pageCount << ", free " << r.d_freePages << endl;
+	for( int i = 0; i < r.d_tables.size(); i++ )
+	{
+		const BtreeStore::TableStats& s = r.d_tables[i].d_stats;
+		out << r.d_tables[i].d_name << " (root " << s.d_table << "): pages " << s.d_pages
+			<< " (leaf " << s.d_leafPages << ", overflow " << s.d_overflowPages << "), depth " << s.d_depth
+			<< ", entries " << s.d_entries << ", payload " << s.d_payload
+			<< ", fill " << int( s.getFill() * 100.0 + 0.5 ) << "%" << endl;
+		_printHistogram( out, "key sizes", s.d_keySizes );
+		_printHistogram( out, "value sizes", s.d_valueSizes );
+	}
+	if( !r.d_largest.isEmpty() )
+		out << "largest objects:" << endl;
+	for( int i = 0; i < r.d_largest.size(); i++ )
+		out << "    oid " << r.d_largest[i].d_oid << " type " << r.d_largest[i].d_type
+			<< ": " << r.d_largest[i].d_bytes << " bytes in " << r.d_largest[i].d_fields << " fields" << endl;
+}
+
 quint32 Database::findIndex( const QByteArray& name )
 {
 	Lock lock( this );
@@ -583,6 +1694,13 @@ bool Database::isReadOnly() const
 	return d_db->isReadOnly();
 }
 
+int Database::getPageSize() const
+{
+	checkOpen();
+	Lock lock( const_cast<Database*>(this) );
+	return d_db->getPageSize();
+}
+
 quint32 Database::createIndex( const QByteArray& name, const IndexMeta& meta )
 {
 	TxnGuard lock( this );
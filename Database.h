@@ -22,14 +22,25 @@
 
 #include <QObject>
 #include <QMutex>
+#include <QReadWriteLock>
+#include <QAtomicPointer>
+#include <QWaitCondition>
+#include <QTime>
 #include <QHash>
+#include <QVector>
+#include <QCache>
 #include <Udb/UpdateInfo.h>
 #include <Udb/IndexMeta.h>
+#include <Udb/BtreeStore.h>
+
+class QTextStream;
 
 namespace Udb
 {
 	class BtreeStore;
 	class Transaction;
+	class AsyncWriter;
+	class BtreeCursor;
 	typedef quint32 Atom;
 	typedef quint64 OID;
 
@@ -40,7 +51,7 @@ namespace Udb
 	{ 
 		Q_OBJECT
 	public:
-		class Lock // Um den Mutex zu sperren
+		class Lock // Exklusiv, fuer alle schreibenden Zugriffe
 		{
 		public:
 			Lock(Database*);
@@ -48,6 +59,20 @@ namespace Udb
 		private:
 			Database* d_db;
 		};
+		// Geteilt, fuer reine Lesezugriffe; mehrere Leser warten nicht aufeinander, nur auf Lock.
+		// Die Btree-Aufrufe selbst bleiben ueber den BtreeStore-Mutex serialisiert, da Sqlite ohne
+		// SQLITE_THREADSAFE gebaut ist; parallel laufen nur Caches und Code ausserhalb des Stores.
+		// Unter ReadLock darf kein Lock angefordert werden (Deadlock), auch nicht indirekt ueber
+		// getAtom fuer ein neues Atom; umgekehrt schon: fuer den Thread, der Lock oder TxnGuard haelt,
+		// ist ReadLock ein No-op.
+		class ReadLock
+		{
+		public:
+			ReadLock(Database*);
+			~ReadLock();
+		private:
+			Database* d_db; // 0..Thread haelt bereits Lock
+		};
 		class TxnGuard // Um mehrere DB-Transaktionen in eine zusammenzufassen, was schneller geht
 		{
 		public:
@@ -62,8 +87,49 @@ namespace Udb
 		Database( QObject* = 0 );
 		~Database(); // threadsafe
 
-		void open( const QString& path, bool readOnly = false ); // threadsafe
-		void close(); // threadsafe
+		// resident: nur lesend, Page-Cache fasst die ganze Datei im Rahmen von setCacheMemory (ohne
+		// Budget 64 MB); fuer Auswertungen mit grossen sequentiellen Scans.
+		// pageSize: Bytes pro Page (Zweierpotenz ab 512), nur beim Anlegen der Datei; 0..Default
+		// exclusive: nur lesend, haelt den Shared-Lock bis close(), damit der Cache nie verworfen wird.
+		// Blockiert Commits anderer Prozesse.
+		void open( const QString& path, bool readOnly = false, bool resident = false, int pageSize = 0,
+				   bool exclusive = false ); // threadsafe
+		void close(); // threadsafe, wartet auf Transaction::commitAsync; nicht unter Lock aufrufen
+		// Datenbank nur im Speicher; geht bei close verloren, sofern nicht mit saveTo gesichert
+		void openInMemory( int pageSize = 0 ); // threadsafe
+		void loadFrom( const QString& path ); // threadsafe, openInMemory mit einer Kopie der Datei
+		void saveTo( const QString& path ); // threadsafe, Snapshot; ersetzt path erst am Schluss
+		bool isInMemory() const; // threadsafe
+		// threadsafe, Online-Backup: kopiert je pagesPerStep Pages und gibt den Store dazwischen frei.
+		// Von Commits veraenderte Pages werden in weiteren Durchgaengen nachgefuehrt, bis ein Durchgang
+		// ohne Commit durchlaeuft; spaetestens der letzte Durchgang haelt Commits bis zum Ende auf.
+		void backup( QIODevice*, int pagesPerStep = 256 );
+		void backup( const QString& path, int pagesPerStep = 256 ); // ersetzt path erst am Schluss
+
+		struct TableReport
+		{
+			QString d_name; // "objTable" etc., "index <name>" oder "global <id>"
+			BtreeStore::TableStats d_stats;
+		};
+		struct ObjectReport
+		{
+			OID d_oid;
+			Atom d_type;
+			quint32 d_fields;
+			quint64 d_bytes; // Keys und Values aller Zeilen des Objekts in der objTable
+		};
+		struct StorageReport
+		{
+			int d_pageSize;
+			quint32 d_pageCount;
+			quint32 d_freePages;
+			QList<TableReport> d_tables;
+			QList<ObjectReport> d_largest; // absteigend nach d_bytes
+			StorageReport():d_pageSize(0),d_pageCount(0),d_freePages(0){}
+		};
+		// threadsafe, liest alle Btrees ganz und haelt dabei den Lock; largest..Anzahl groesster Objekte
+		StorageReport analyzeStorage( int largest = 20 );
+		static void printStorageReport( const StorageReport&, QTextStream& );
 
 		Index createIndex( const QByteArray& name, const IndexMeta& ); // threadsafe
 		void removeIndex( const QByteArray& name ); // threadsafe
@@ -77,6 +143,7 @@ namespace Udb
 		QByteArray getAtomString( Atom ); // threadsafe
 
 		OID getMaxOid(); // threadsafe
+		quint32 getTypeCount( Atom type ); // threadsafe, Anzahl committeter Objekte dieses Typs
 
 		// Post-Commit-Notification
 		void addObserver( QObject*, const char* slot, bool asynch = true ); // threadsafe
@@ -85,7 +152,58 @@ namespace Udb
 		QString getFilePath() const; // threadsafe
 		QUuid getDbUuid(bool create = true); // threadsafe, GUID dieser DB-Datei
 		bool isReadOnly() const;
+		int getPageSize() const; // threadsafe
 		void setCacheSize( int numOfPages ); // threadsafe, default 100, min. 20
+		// threadsafe, Cache-Budget in Bytes (z.B. 512 MB); wirkt sofort und bei jedem weiteren open
+		void setCacheMemory( qint64 bytes );
+		struct FieldCacheStats
+		{
+			quint64 d_hits;
+			quint64 d_misses;
+			quint64 d_invalidations;	// durch Commit verworfene Eintraege
+			int d_entries;
+			qint64 d_cost;				// belegte Bytes (Naeherung)
+			qint64 d_maxCost;
+			FieldCacheStats():d_hits(0),d_misses(0),d_invalidations(0),d_entries(0),d_cost(0),d_maxCost(0){}
+		};
+		// threadsafe, LRU-Cache der von Transaction::getField dekodierten Werte ueber alle Transaktionen,
+		// Schluessel (oid, atom); Budget in Bytes, 0 schaltet ab (default). Commit verwirft genau die
+		// geschriebenen Felder.
+		void setFieldCacheMemory( qint64 bytes );
+		FieldCacheStats getFieldCacheStats() const; // threadsafe
+		// threadsafe, LRU-Cache Uuid <-> OID ueber alle Transaktionen fuer Transaction::getObject(QUuid),
+		// getObjects und getUuid; Anzahl Paare (default 10000), 0 schaltet ab. Commit haelt ihn nach.
+		void setUuidCacheSize( int entries );
+		// threadsafe, inkrementelles Auto-Vacuum fuer danach neu angelegte Dateien
+		void setAutoVacuum( bool on );
+		// threadsafe, schiebt Pages vom Dateiende in Luecken und kuerzt die Datei, hoechstens maxMillis
+		// lang pro Aufruf; true..nichts mehr zu tun. Nur fuer Dateien mit Auto-Vacuum.
+		bool compact( int maxMillis = 50 );
+		quint32 getFreePageCount() const; // threadsafe
+		// threadsafe, OIDs geloeschter und verworfener neuer Objekte werden wieder vergeben.
+		// Nur fuer Datenbanken, in denen keine Referenzen auf geloeschte Objekte zurueckbleiben.
+		void setRecycleOids( bool on );
+		bool isRecycleOids() const { return d_recycleOids; }
+		// threadsafe, Transaction::create reserviert OIDs blockweise mit einem Schreibzugriff auf den
+		// Zaehler und vergibt sie dann aus dem Speicher (default 1024, 1..je OID ein Schreibzugriff).
+		// Nach einem Absturz bleibt der unverbrauchte Rest eines Blocks als Luecke; close gibt ihn zurueck.
+		void setOidBlockSize( quint32 );
+		quint32 getOidBlockSize() const { return d_oidBlock; }
+		// threadsafe, kompaktes Key-Format <oid> <varint atom> der Objekt-Tabelle fuer danach neu
+		// angelegte Datenbanken; bestehende behalten ihr Format (siehe Record.h)
+		void setCompactKeys( bool on );
+		bool hasCompactKeys() const; // threadsafe, Format der offenen Datenbank
+		// threadsafe, Objekte dieses Typs speichern alle nicht reservierten Felder in einer Zeile
+		// (siehe Record.h); wirkt beim naechsten Commit eines Objekts, bestehende mit packObjects.
+		void setPackedType( Atom type, bool on = true );
+		bool isPackedType( Atom type ) const; // threadsafe
+		// threadsafe, Migration: bringt alle Objekte von type ins eingestellte Format; Anzahl geaenderter
+		int packObjects( Atom type );
+		// threadsafe, Gruppen-Commit: Transaktionen, die innerhalb von windowMs committen, werden
+		// in eine Store-Transaktion mit einem einzigen Sync geschrieben, hoechstens maxTxns pro Gruppe.
+		// Jedes Transaction::commit kehrt erst nach dem Sync zurueck. maxTxns <= 1 schaltet ab (default).
+		void setGroupCommit( int maxTxns, int windowMs = 10 );
+		void flushGroupCommit(); // threadsafe, schreibt die offene Gruppe sofort
 		void dumpAtoms();
         void registerDatabase();
 		static void registerDatabase( const QUuid&, const QString& path );
@@ -93,39 +211,118 @@ namespace Udb
         static bool runDatabaseApp( const QUuid&, const QStringList & moreArgs = QStringList() );
 	signals:
 		void notify( Udb::UpdateInfo ); 
+		void backupProgress( int pass, qint64 pagesDone, qint64 pagesTotal, qint64 bytesPerSecond );
 	private: 
 		friend class Transaction;
 		friend class Qit;
 		friend class Mit;
         friend class Xit;
 		friend class Lock;
+		friend class ReadLock;
 		friend class Extent;
 		friend class Global;
 
+		int getTable( int& );
 		int getObjTable();
 		int getDirTable();
 		int getIdxTable();
 		int getQueTable();
 		int getMapTable();
         int getOixTable();
+		int getExtTable(); // 0..nur lesend offen und Verzeichnis fehlt (aeltere Datei)
+		int getTypTable(); // dito
 		void checkOpen() const;
 		void loadMeta();
+		void createTables();
+		quint32 findAtom( const QByteArray& ); // 0..nicht vorhanden
+		void buildExtent();
+		void clearCaches();
 		void saveMeta();
 		BtreeStore* getStore() const { return d_db; }
 		OID getNextOid(bool persistent = true);
+		void releaseOids();
+		void freeOid( OID, BtreeCursor& objCur );
 		quint32 getNextQueueNr(quint64 oid);
+		quint32 joinCommitGroup();
+		void closeCommitGroup( quint32 group );
+		void abortCommitGroup( quint32 group, const QString& msg ); // writeChanges eines Mitglieds scheiterte
+		void failCommitGroup( quint32 group, int members, const QString& msg );
+		void waitCommitGroup( quint32 group );
+		void enqueueWrite( Transaction* ); // Writer-Thread ruft Transaction::writePending auf
+		void stopWriter();
+		bool backupPass( QIODevice*, int pagesPerStep, int pass, QVector<quint64>& sums, qint64& written, const QTime& );
+		bool getCachedField( OID, Atom, Stream::DataCell& ) const;
+		void cacheField( OID, Atom, const Stream::DataCell&, int bytes ) const; // unter ReadLock oder Lock
+		void uncacheField( OID, Atom ); // unter Lock
+		void checkFieldAborts() const; // unter d_fieldLock
+		OID getCachedOid( const QUuid& ) const;
+		QUuid getCachedUuid( OID ) const;
+		void cacheUuid( const QUuid&, OID ) const; // unter ReadLock oder Lock
+		void uncacheUuid( OID, BtreeCursor& objCur ); // unter Lock, vor dem Aendern oder Loeschen der Uuid
+		void checkUuidAborts() const; // unter d_uuidLock
 	private:
 		BtreeStore* d_db;
+		qint64 d_cacheMem;
+		bool d_autoVacuum;
+		bool d_recycleOids;
+		bool d_oidFree;		// Freelist der OIDs kann Eintraege haben
+		quint32 d_oidBlock;
+		OID d_oidNext;		// naechste OID aus dem reservierten Block
+		OID d_oidLimit;		// letzte reservierte OID, entspricht dem Zaehler in der Datei; 0..kein Block
+		quint32 d_oidAborts;	// BtreeStore::getAbortCount bei der Reservation
+		bool d_compactKeys; // gewuenschtes Format fuer neue Datenbanken
+		// Sperrreihenfolge, nie umgekehrt:
+		//   d_lock (Lock, ReadLock, TxnGuard) -> d_groupLock -> BtreeStore-Mutex
+		//   d_lock -> d_atomLock -> BtreeStore-Mutex
+		// d_fieldLock, d_uuidLock und Transaction::d_pendingLock sind Blatt-Sperren: unter ihnen wird
+		// nichts weiter gesperrt, sie duerfen darum auch unter dem BtreeStore-Mutex genommen werden.
+		// Den BtreeStore-Mutex halten nur einzelne Store-Aufrufe und BtreeStore::WriteLock, nie ein
+		// Aufrufer, der danach noch d_lock, d_groupLock oder d_atomLock anfordert.
 #ifdef DATABASE_HAS_MUTEX
-		QMutex d_lock; // jeder Zugriff auf public wird serialisiert
+		QReadWriteLock d_lock; // Schreiber exklusiv, Leser geteilt
+		QAtomicPointer<void> d_lockOwner; // Qt::HANDLE des Threads mit Lock
+		int d_lockDepth; // nur vom Thread mit Lock
+		QMutex d_atomLock; // d_dir/d_invDir und Anlegen von Atomen; nach d_lock, vor dem BtreeStore-Mutex
 #endif
-		QHash<quint32,Transaction*> d_objLocks;
-		QList<quint32> d_objDeletes;
+		AsyncWriter* d_writer;
+		typedef QPair<OID,Atom> FieldKey;
+		mutable QMutex d_fieldLock; // auch Leser unter ReadLock fuellen den Cache
+		mutable QCache<FieldKey,Stream::DataCell> d_fieldCache;
+		mutable quint64 d_fieldHits;
+		mutable quint64 d_fieldMisses;
+		quint64 d_fieldInvalidations;
+		mutable quint32 d_fieldAborts; // BtreeStore::getAbortCount, zu dem die Eintraege passen
+		mutable QMutex d_uuidLock;
+		mutable QCache<QByteArray,OID> d_uuidToOid; // Key: Uuid-Cell
+		mutable QCache<OID,QUuid> d_oidToUuid;
+		mutable quint32 d_uuidAborts; // BtreeStore::getAbortCount, zu dem die Eintraege passen
+		typedef QPair<Transaction*,quint32> ObjLock; // Besitzer, Commit-Satz des Besitzers (Transaction::d_lockGen)
+		QHash<OID,ObjLock> d_objLocks;
+		// Gruppen-Commit; d_groupLock wird immer nach d_lock und vor dem BtreeStore-Mutex gesperrt
+		QMutex d_groupLock;
+		QWaitCondition d_groupDone;
+		QTime d_groupStart;
+		QHash<quint32, QPair<int,QString> > d_groupErrors; // Gruppe -> ausstehende Mitglieder, Fehler
+		int d_groupMax;
+		int d_groupWindow;
+		int d_groupCount;		// Mitglieder der offenen Gruppe
+		quint32 d_groupNr;		// offene Gruppe oder 0
+		quint32 d_groupSeq;
+		quint32 d_groupClosed;	// zuletzt abgeschlossene Gruppe
+		quint32 d_groupAborts;	// BtreeStore::getAbortCount beim Oeffnen der Gruppe
+		QList<OID> d_objDeletes;
+		struct QueueNrs
+		{
+			quint32 d_next;		// naechste Nummer aus dem reservierten Block
+			quint32 d_limit;	// letzte reservierte Nummer, entspricht dem Zaehler in der Datei
+			quint32 d_aborts;	// BtreeStore::getAbortCount bei der Reservation
+		};
+		QHash<OID,QueueNrs> d_queueNrs; // Queue -> reservierter Block, ueber alle Transaktionen
 
 		struct Meta
 		{
 			Meta():d_objTable(0),d_dirTable(0),d_idxTable(0),d_queTable(0),
-                d_mapTable(0),d_oixTable(0){}
+                d_mapTable(0),d_oixTable(0),d_extTable(0),d_typTable(0),d_pageSize(0),d_compactKeys(false),d_packed(false){}
 
 			int d_objTable; // Btree mit ID->Record und UUID->ID
 			int d_dirTable; // Btree mit Atom->Name und Name->Atom
@@ -133,6 +330,12 @@ namespace Udb
 			int d_queTable; // Btree mit <oid> <nr> -> <cell>
 			int d_mapTable; // Btree mit <oid> [ <cell> ]* -> <cell>
             int d_oixTable; // Btree mit <oid> <rawbytes> -> <cell>
+			int d_extTable; // Btree mit <oid> -> <type atom | null>, eine Zeile pro Objekt; 0 bei aelteren Dateien
+			int d_typTable; // Btree mit <type> -> <id32 anzahl> und <type> <oid> -> leer; 0 bei aelteren Dateien
+			int d_pageSize; // beim Anlegen gewaehlte Page-Groesse; 0 bei aelteren Dateien
+			bool d_compactKeys; // Key-Format der Objekt-Tabelle; false bei aelteren Dateien
+			bool d_packed;		// es wurden je Typen gepackt, d.h. es kann gepackte Zeilen geben
+			QSet<Atom> d_packedTypes;
 		};
 		Meta d_meta;
 
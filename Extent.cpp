@@ -39,8 +39,72 @@ Obj Extent::getObj() const
 bool Extent::first()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb());
+	if( d_type == 0 )
+		return firstImp();
+	Database::ReadLock lock( d_txn->getDb());
+	const int typ = d_txn->getDb()->getTypTable();
+	if( typ != 0 )
+		return seekType( typ, true );
+	// Aeltere Datei nur lesend offen; alle Objekte durchgehen
+	bool run = firstImp();
+	while( run && getObj().getType() != d_type )
+		run = nextImp();
+	return run;
+}
+
+bool Extent::next()
+{
+	checkNull();
+	if( d_oid == 0 )
+		return false;
+	if( d_type == 0 )
+		return nextImp();
+	Database::ReadLock lock( d_txn->getDb());
+	const int typ = d_txn->getDb()->getTypTable();
+	if( typ != 0 )
+		return seekType( typ, false );
+	bool run = nextImp();
+	while( run && getObj().getType() != d_type )
+		run = nextImp();
+	return run;
+}
+
+bool Extent::seekType( int table, bool first )
+{
+	// NOTE: Caller ist fuer ReadLock verantwortlich
+	const QByteArray prefix = Stream::DataCell().setAtom( d_type ).writeCell();
+	QByteArray key = prefix;
+	if( !first )
+		key += Stream::DataCell().setOid( d_oid ).writeCell();
 	BtreeCursor cur;
+	cur.open( d_txn->getStore(), table );
+	// Exakter Treffer ist der Zaehler <type> bzw. das aktuelle Objekt; sonst steht moveTo schon dahinter
+	if( cur.moveTo( key ) && !cur.moveNext() )
+		return false;
+	if( !cur.isValidPos() || !cur.keyStartsWith( prefix ) )
+		return false;
+	Stream::DataCell v;
+	v.readCell( cur.readKey().mid( prefix.size() ) );
+	d_oid = v.getOid();
+	return true;
+}
+
+bool Extent::firstImp()
+{
+	Database::ReadLock lock( d_txn->getDb());
+	BtreeCursor cur;
+	const int ext = d_txn->getDb()->getExtTable();
+	if( ext != 0 )
+	{
+		// Objektverzeichnis, eine Zeile pro Objekt
+		cur.open( d_txn->getStore(), ext );
+		if( !cur.moveFirst() )
+			return false;
+		Stream::DataCell v;
+		v.readCell( cur.readKey() );
+		d_oid = v.getOid();
+		return true;
+	}
 	cur.open( d_txn->getStore(), d_txn->getDb()->getObjTable() );
 	bool run = cur.moveFirst();
 	Stream::DataCell v;
@@ -57,17 +121,27 @@ bool Extent::first()
 	return false;
 }
 
-bool Extent::next()
+bool Extent::nextImp()
 {
-	checkNull();
-	if( d_oid == 0 )
-		return false;
-	Database::Lock lock( d_txn->getDb());
+	Database::ReadLock lock( d_txn->getDb());
 	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_txn->getDb()->getObjTable() );
-
 	Stream::DataCell v;
 	v.setOid( d_oid );
+	const int ext = d_txn->getDb()->getExtTable();
+	if( ext != 0 )
+	{
+		cur.open( d_txn->getStore(), ext );
+		// moveTo steht bei false bereits auf dem naechsten Objekt, falls d_oid inzwischen geloescht wurde
+		if( cur.moveTo( v.writeCell() ) && !cur.moveNext() )
+			return false;
+		if( !cur.isValidPos() )
+			return false;
+		v.readCell( cur.readKey() );
+		d_oid = v.getOid();
+		return true;
+	}
+	cur.open( d_txn->getStore(), d_txn->getDb()->getObjTable() );
+
 	if( !cur.moveTo( v.writeCell(), true ) )
 		return false;
 	bool run = cur.moveNext();
@@ -146,10 +220,16 @@ QString Extent::checkDb(Transaction * t, bool fix)
 	OpairList reparent;
 	OpairList fixFirstObj;
 	OpairList fixLastObj;
+	// Verkettungsfelder je Objekt in einem Durchgang lesen
+	const Obj::Names superNames = Obj::Names() << Record::FieldFirstObj << Record::FieldLastObj
+			<< Record::FieldParent << Record::FieldPrevObj << Record::FieldNextObj;
+	const Obj::Names subNames = Obj::Names() << Record::FieldParent << Record::FieldPrevObj << Record::FieldNextObj;
 	if( e.first() ) do
 	{
 		ContentObject super = e.getObj();
-		ContentObject sub = super.getFirstObj();
+		const Obj::ValueList sv = super.getValues( superNames );
+		const ContentObject superLast = Obj( sv[1].getOid(), t );
+		ContentObject sub = Obj( sv[0].getOid(), t );
 		ContentObject prev;
 		if( !sub.isNull() ) do
 		{
@@ -157,7 +237,8 @@ QString Extent::checkDb(Transaction * t, bool fix)
 			OpairList _fixFirstObj;
 			OpairList _fixLastObj;
 			bool toFix = false;
-			const ContentObject parent = sub.getParent();
+			const Obj::ValueList v = sub.getValues( subNames );
+			const ContentObject parent = Obj( v[0].getOid(), t );
 			if( !parent.equals( super ) )
 			{
 				out << QString("Obj %1/%2 '%3' is contained in %4/%5 '%6' but references %7/%8 '%9' as parent")
@@ -167,7 +248,7 @@ QString Extent::checkDb(Transaction * t, bool fix)
 				toFix = true;
 				_reparent.append( qMakePair( sub, super ) );
 			}
-			ContentObject other = sub.getPrev();
+			ContentObject other = ( v[1].isNull() )? Obj() : t->getObject( v[1].getOid() );
 			if( prev.isNull() && !other.isNull() )
 			{
 				out << QString("Obj %1/%2 '%3' is first in list but points to %4/%5 '%6' as predecessor")
@@ -199,8 +280,8 @@ QString Extent::checkDb(Transaction * t, bool fix)
 							.arg(other.getOid()).arg(other.getType()).arg(text(other)) << endl;
 				toFix = false;
 			}
-			other = sub.getNext();
-			if( super.getLastObj().equals(sub) && !other.isNull() )
+			other = ( v[2].isNull() )? Obj() : t->getObject( v[2].getOid() );
+			if( superLast.equals(sub) && !other.isNull() )
 			{
 				out << QString("Obj %1/%2 '%3' is last in list but points to %4/%5 '%6' as successor")
 							.arg(sub.getOid()).arg(sub.getType()).arg(text(sub))
@@ -232,10 +313,10 @@ QString Extent::checkDb(Transaction * t, bool fix)
 			}
 			prev = sub;
 		}while( sub.next() );
-		if( super.getParent().isNull(true,true) )
+		if( Obj( sv[2].getOid(), t ).isNull(true,true) )
 		{
 			bool toDelete = true;
-			ContentObject prev = super.getPrev();
+			ContentObject prev = ( sv[3].isNull() )? Obj() : t->getObject( sv[3].getOid() );
 			if( !prev.isNull() )
 			{
 				out << QString("Obj %1/%2 '%3' has no parent but points to %4/%5 '%6' as predecessor")
@@ -243,7 +324,7 @@ QString Extent::checkDb(Transaction * t, bool fix)
 							.arg(prev.getOid()).arg(prev.getType()).arg(text(prev)) << endl;
 				toDelete = false;
 			}
-			ContentObject next = super.getNext();
+			ContentObject next = ( sv[4].isNull() )? Obj() : t->getObject( sv[4].getOid() );
 			if( !next.isNull() )
 			{
 				out << QString("Obj %1/%2 '%3' has no parent but points to %4/%5 '%6' as successor")
@@ -251,7 +332,7 @@ QString Extent::checkDb(Transaction * t, bool fix)
 							.arg(next.getOid()).arg(next.getType()).arg(text(next)) << endl;
 				toDelete = false;
 			}
-			if( super.getFirstObj().isNull() && super.getUuid(false).isNull() )
+			if( sv[0].isNull() && super.getUuid(false).isNull() )
 			{
 				out << QString("Obj %1/%2 '%3' has no parent, no uuid and no children")
 							.arg(super.getOid()).arg(super.getType()).arg(text(super));
@@ -31,19 +31,27 @@ namespace Udb
 	class Extent
 	{
 	public:
-		Extent():d_txn(0),d_oid(0) {}
-		Extent( Transaction* t ):d_txn(t),d_oid(0) {}
+		Extent():d_txn(0),d_oid(0),d_type(0) {}
+		Extent( Transaction* t ):d_txn(t),d_oid(0),d_type(0) {}
+		// Nur Objekte dieses Typs in OID-Reihenfolge, ueber den eingebauten Typ-Index; sieht wie
+		// Extent ohne Typ nur committete Objekte
+		Extent( Transaction* t, Atom type ):d_txn(t),d_oid(0),d_type(type) {}
 		bool first();
 		bool next();
 		Obj getObj() const;		
+		Atom getType() const { return d_type; }
 
 		static void eraseOrphans( Transaction* ); // Bereinigt den Bug in Record::eraseFields
 		static QString checkDb( Transaction*, bool fix = false );
 	protected:
 		void checkNull() const;
+		bool firstImp();
+		bool nextImp();
+		bool seekType( int table, bool first );
 	private:
 		Transaction* d_txn;
 		quint64 d_oid;
+		Atom d_type;
 	};
 }
 
@@ -35,7 +35,8 @@ bool Global::open(quint32 id)
 	d_db->checkOpen();
 	if( id == d_db->d_meta.d_objTable || id == d_db->d_meta.d_dirTable ||
 		id == d_db->d_meta.d_idxTable || id == d_db->d_meta.d_queTable ||
-		id == d_db->d_meta.d_mapTable || id == d_db->d_meta.d_oixTable )
+		id == d_db->d_meta.d_mapTable || id == d_db->d_meta.d_oixTable ||
+		id == d_db->d_meta.d_extTable || id == d_db->d_meta.d_typTable )
 		return false; // id gehrt einer internen Tabelle
 	BtreeCursor cur;
 	cur.open( d_db->getStore(), d_db->getIdxTable(), false );
@@ -183,7 +184,7 @@ BtreeStore *Global::getStore() const
 bool Git::seek(const QByteArray &key)
 {
 	checkNull();
-	Database::Lock lock( d_global->d_db );
+	Database::ReadLock lock( d_global->d_db );
 	d_key = key;
 	d_cur.clear();
 	if( d_key.isEmpty() )
@@ -206,7 +207,7 @@ void Git::getValue(QByteArray &v) const
 	if( !d_cur.startsWith( d_key ) )
 		return;
 
-	Database::Lock lock( d_global->d_db );
+	Database::ReadLock lock( d_global->d_db );
 	BtreeCursor cur;
 	cur.open( d_global->getStore(), d_global->d_table, false );
 	if( cur.moveTo( d_cur ) )
@@ -256,7 +257,7 @@ Stream::DataCell Git::getValueAsCell() const
 bool Git::firstKey()
 {
 	checkNull();
-	Database::Lock lock( d_global->d_db );
+	Database::ReadLock lock( d_global->d_db );
 	d_cur.clear();
 	BtreeCursor cur;
 	cur.open( d_global->getStore(), d_global->d_table );
@@ -279,7 +280,7 @@ bool Git::firstKey()
 bool Git::nextKey()
 {
 	checkNull();
-	Database::Lock lock( d_global->d_db );
+	Database::ReadLock lock( d_global->d_db );
 	BtreeCursor cur;
 	cur.open( d_global->getStore(), d_global->d_table );
 	cur.moveTo( d_cur ); // zur letztbekannten oder neu verlangten Position
@@ -294,7 +295,7 @@ bool Git::nextKey()
 bool Git::prevKey()
 {
 	checkNull();
-	Database::Lock lock( d_global->d_db );
+	Database::ReadLock lock( d_global->d_db );
 	BtreeCursor cur;
 	cur.open( d_global->getStore(), d_global->d_table );
 	cur.moveTo( d_cur ); // zur letztbekannten oder neu verlangten Position
@@ -24,17 +24,20 @@
 #include "Transaction.h"
 #include "Database.h"
 #include "Extent.h"
+#include <QTemporaryFile>
+#include <QDataStream>
 #include <cassert>
+#include <cstring>
 using namespace Udb;
 using namespace Stream;
 
-Idx::Idx( Transaction* txn, int idx )
+Idx::Idx( Transaction* txn, int idx ):d_scan(0),d_scanCount(0),d_scanValid(false)
 {
 	d_txn = txn;
 	d_idx = idx;
 }
 
-Idx::Idx( Transaction* txn, const QByteArray& name )
+Idx::Idx( Transaction* txn, const QByteArray& name ):d_scan(0),d_scanCount(0),d_scanValid(false)
 {
 	assert( txn );
 	d_txn = txn;
@@ -43,17 +46,23 @@ Idx::Idx( Transaction* txn, const QByteArray& name )
 		d_txn = 0;
 }
 
-Idx::Idx( const Idx& lhs )
+Idx::Idx( const Idx& lhs ):d_scan(0),d_scanCount(0),d_scanValid(false)
 {
 	d_txn = 0;
 	d_idx = 0;
 	*this = lhs;
 }
 
+Idx::~Idx()
+{
+	endScan();
+}
+
 Idx& Idx::operator=( const Idx& r )
 {
 	if( d_idx == r.d_idx )
 		return *this;
+	endScan(); // Der Scan-Cursor wird nicht kopiert
 	d_txn = r.d_txn;
 	d_idx = r.d_idx;
 	d_cur = r.d_cur;
@@ -67,52 +76,125 @@ void Idx::checkNull() const
 		throw DatabaseException(DatabaseException::AccessRecord, "Idx::checkNull");
 }
 
-bool Idx::first()
+void Idx::beginScan()
 {
 	checkNull();
+	if( d_scan )
+		return;
 	Database::Lock lock( d_txn->getDb());
-	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_idx );
-	if( cur.moveFirst() )
+	d_scan = new BtreeCursor();
+	d_scan->open( d_txn->getStore(), d_idx );
+	d_scanValid = false; // Erst nach der ersten Positionierung gueltig
+}
+
+void Idx::endScan()
+{
+	if( d_scan == 0 )
+		return;
+	Database::Lock lock( d_txn->getDb());
+	delete d_scan;
+	d_scan = 0;
+	d_scanValid = false;
+}
+
+BtreeCursor* Idx::cursor( BtreeCursor& tmp ) const
+{
+	if( d_scan )
+		return d_scan;
+	tmp.open( d_txn->getStore(), d_idx );
+	return &tmp;
+}
+
+bool Idx::isScanPos() const
+{
+	// true..d_scan steht noch auf d_cur und der Store wurde seither nicht veraendert
+	return d_scan != 0 && d_scanValid && d_scanCount == d_txn->getStore()->getChangeCount();
+}
+
+void Idx::readCur( BtreeCursor* cur )
+{
+	if( cur != d_scan )
+	{
+		d_cur = cur->readKey();
+		return;
+	}
+	// Scan-Modus: Key direkt von der Page in den bestehenden Puffer kopieren, ohne neues QByteArray
+	int len;
+	const char* key = cur->fetchKey( len );
+	d_cur.resize( len );
+	::memcpy( d_cur.data(), key, len );
+}
+
+void Idx::setScanPos( bool valid )
+{
+	if( d_scan == 0 )
+		return;
+	d_scanValid = valid;
+	d_scanCount = d_txn->getStore()->getChangeCount();
+}
+
+bool Idx::first()
+{
+	checkNull();
+	Database::ReadLock lock( d_txn->getDb());
+	BtreeCursor tmp;
+	BtreeCursor* cur = cursor( tmp );
+	if( cur->moveFirst() )
 	{
-		d_cur = cur.readKey();
+		readCur( cur );
+		setScanPos( true );
 		return true;
 	}else
+	{
+		setScanPos( false );
 		return false;
+	}
 }
 
 bool Idx::last()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb());
-	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_idx );
-	if( cur.moveLast() )
+	Database::ReadLock lock( d_txn->getDb());
+	BtreeCursor tmp;
+	BtreeCursor* cur = cursor( tmp );
+	if( cur->moveLast() )
 	{
-		d_cur = cur.readKey();
+		readCur( cur );
+		setScanPos( true );
 		return true;
 	}else
+	{
+		setScanPos( false );
 		return false;
+	}
 }
 
-bool Idx::next()
+bool Idx::step( bool forward )
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
-	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_idx );
-	cur.moveTo( d_cur ); // zur letztbekannten oder neu verlangten Position
-	if( cur.moveNext() )
+	Database::ReadLock lock( d_txn->getDb() );
+	BtreeCursor tmp;
+	BtreeCursor* cur = cursor( tmp );
+	if( !isScanPos() )
+		cur->moveTo( d_cur ); // zur letztbekannten oder neu verlangten Position
+	if( (forward)? cur->moveNext() : cur->movePrev() )
 	{
-		d_cur = cur.readKey();
+		readCur( cur );
+		setScanPos( true );
 		return true;
 	}else
     {
 		// d_cur.clear(); // Nein, sonst beginnt bei nchstem next wieder von vorne!
+		setScanPos( false );
 		return false;
     }
 }
 
+bool Idx::next()
+{
+	return step( true );
+}
+
 bool Idx::nextKey()
 {
 	if( next() )
@@ -142,32 +224,29 @@ bool Idx::isOnIndex() const
 OID Idx::getOid()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
-	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_idx );
-	if( !cur.moveTo( d_cur ) )
-		return 0; // zur letztbekannten oder neu verlangten Position
+	Database::ReadLock lock( d_txn->getDb() );
 	DataCell id;
-	id.readCell( cur.readValue() );
+	if( isScanPos() )
+	{
+		// Cursor steht bereits auf d_cur; kein erneutes moveTo noetig
+		id.readCell( d_scan->readValue() );
+		return id.getOid();
+	}
+	BtreeCursor tmp;
+	BtreeCursor* cur = cursor( tmp );
+	if( !cur->moveTo( d_cur ) )
+	{
+		setScanPos( false );
+		return 0; // zur letztbekannten oder neu verlangten Position
+	}
+	setScanPos( true );
+	id.readCell( cur->readValue() );
 	return id.getOid();
 }
 
 bool Idx::prev()
 {
-	checkNull();
-	Database::Lock lock( d_txn->getDb());
-	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_idx );
-	cur.moveTo( d_cur ); // zur letztbekannten oder neu verlangten Position
-	if( cur.movePrev() )
-	{
-		d_cur = cur.readKey();
-		return true;
-	}else
-    {
-		// d_cur.clear(); // Nein
-		return false;
-    }
+	return step( false );
 }
 
 bool Idx::seek( const Stream::DataCell& key )
@@ -176,19 +255,24 @@ bool Idx::seek( const Stream::DataCell& key )
 	Database::Lock lock( d_txn->getDb());
 	d_key.clear();
 	d_cur.clear();
+	d_scanValid = false;
 	IndexMeta meta;
 	d_txn->getDb()->getIndexMeta( d_idx, meta );
 	if( meta.d_items.isEmpty() )
 		return false;
 	addElement( d_key, meta.d_items[0], key );
-	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_idx );
-	if( cur.moveTo( d_key, true ) )
+	BtreeCursor tmp;
+	BtreeCursor* cur = cursor( tmp );
+	if( cur->moveTo( d_key, true ) )
 	{
-		d_cur = cur.readKey();
+		readCur( cur );
+		setScanPos( true );
 		return true;
 	}else
+	{
+		setScanPos( false );
 		return false;
+	}
 }
 
 bool Idx::seek( const Stream::DataCell& key1, const Stream::DataCell& key2 )
@@ -197,20 +281,25 @@ bool Idx::seek( const Stream::DataCell& key1, const Stream::DataCell& key2 )
 	Database::Lock lock( d_txn->getDb());
 	d_key.clear();
 	d_cur.clear();
+	d_scanValid = false;
 	IndexMeta meta;
 	d_txn->getDb()->getIndexMeta( d_idx, meta );
 	if( meta.d_items.size() < 2 )
 		return false;
 	addElement( d_key, meta.d_items[0], key1 );
 	addElement( d_key, meta.d_items[1], key2 );
-	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_idx );
-	if( cur.moveTo( d_key, true ) )
+	BtreeCursor tmp;
+	BtreeCursor* cur = cursor( tmp );
+	if( cur->moveTo( d_key, true ) )
 	{
-		d_cur = cur.readKey();
+		readCur( cur );
+		setScanPos( true );
 		return true;
 	}else
+	{
+		setScanPos( false );
 		return false;
+	}
 }
 
 bool Idx::firstKey()
@@ -218,14 +307,19 @@ bool Idx::firstKey()
 	checkNull();
 	Database::Lock lock( d_txn->getDb());
 	d_cur.clear();
-	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_idx );
-	if( cur.moveTo( d_key, true ) )
+	d_scanValid = false;
+	BtreeCursor tmp;
+	BtreeCursor* cur = cursor( tmp );
+	if( cur->moveTo( d_key, true ) )
 	{
-		d_cur = cur.readKey();
+		readCur( cur );
+		setScanPos( true );
 		return true;
 	}else
+	{
+		setScanPos( false );
 		return false;
+	}
 }
 
 bool Idx::gotoCur( const QByteArray& cur )
@@ -233,6 +327,7 @@ bool Idx::gotoCur( const QByteArray& cur )
 	if( cur.startsWith( d_key ) )
 	{
 		d_cur = cur;
+		d_scanValid = false;
 		return true;
 	}else
 		return false;
@@ -244,19 +339,24 @@ bool Idx::seek( const QList<Stream::DataCell>& keys )
 	Database::Lock lock( d_txn->getDb());
 	d_key.clear();
 	d_cur.clear();
+	d_scanValid = false;
 	IndexMeta meta;
 	d_txn->getDb()->getIndexMeta( d_idx, meta );
 	for( int i = 0; i < keys.size() && i < meta.d_items.size(); i++ )
 		addElement( d_key, meta.d_items[i], keys[i] );
 	// TODO: was ist, wenn size von keys und meta.items nicht gleich?
-	BtreeCursor cur;
-	cur.open( d_txn->getStore(), d_idx );
-	if( cur.moveTo( d_key, true ) )
+	BtreeCursor tmp;
+	BtreeCursor* cur = cursor( tmp );
+	if( cur->moveTo( d_key, true ) )
 	{
-		d_cur = cur.readKey();
+		readCur( cur );
+		setScanPos( true );
 		return true;
 	}else
+	{
+		setScanPos( false );
 		return false;
+	}
 }
 
 void Idx::addElement( QByteArray& out, const IndexMeta::Item& i, const Stream::DataCell& v )
@@ -341,7 +441,63 @@ void Idx::clearIndex()
 	d_txn->getStore()->clearTable( d_idx );
 }
 
-void Idx::rebuildIndex()
+typedef QMap<Transaction::ByteArrayHolder,QByteArray> _SortBuf;
+
+static void _writeRun( const _SortBuf& buf, QList<QTemporaryFile*>& runs )
+{
+	QTemporaryFile* f = new QTemporaryFile();
+	runs.append( f );
+	if( !f->open() )
+		throw DatabaseException( DatabaseException::AccessDatabase, "cannot create temporary file for index rebuild" );
+	QDataStream out( f );
+	_SortBuf::const_iterator i;
+	for( i = buf.begin(); i != buf.end(); ++i )
+		out << i.key().d_ba << i.value();
+	f->flush();
+}
+
+static void _mergeRuns( const QList<QTemporaryFile*>& runs, BtreeCursor& cur )
+{
+	// k-Wege-Merge der sortierten Runs; bei gleichen Keys gewinnt wie bei insert der spaeter erzeugte
+	QList<QDataStream*> in;
+	QVector<QByteArray> keys( runs.size() );
+	QVector<QByteArray> values( runs.size() );
+	for( int i = 0; i < runs.size(); i++ )
+	{
+		runs[i]->seek( 0 );
+		in.append( new QDataStream( runs[i] ) );
+		if( !in[i]->atEnd() )
+			*in[i] >> keys[i] >> values[i];
+	}
+	while( true )
+	{
+		int m = -1;
+		for( int i = 0; i < in.size(); i++ )
+		{
+			if( keys[i].isNull() )
+				continue;
+			if( m == -1 || !( Transaction::ByteArrayHolder( keys[m] ) < keys[i] ) )
+				m = i;
+		}
+		if( m == -1 )
+			break;
+		const QByteArray key = keys[m];
+		cur.insertSorted( key, values[m] );
+		for( int i = 0; i < in.size(); i++ )
+		{
+			if( !keys[i].isNull() && keys[i] == key )
+			{
+				if( !in[i]->atEnd() )
+					*in[i] >> keys[i] >> values[i];
+				else
+					keys[i] = QByteArray(); // isNull, Run ist erschoepft
+			}
+		}
+	}
+	qDeleteAll( in );
+}
+
+void Idx::rebuildIndex(int maxSortMem)
 {
 	checkNull();
 	Database::TxnGuard lock( d_txn->getDb());
@@ -354,30 +510,65 @@ void Idx::rebuildIndex()
 	BtreeCursor cur;
 	cur.open( d_txn->getStore(), d_idx, true );
 
+	// Sammle die Eintraege sortiert und lade sie danach in Key-Reihenfolge statt in OID-Reihenfolge.
+	// Passen sie nicht in maxSortMem, werden sortierte Runs in Temp-Files ausgelagert und gemergt.
+	_SortBuf buf;
+	int bufSize = 0;
+	QList<QTemporaryFile*> runs;
+
 	// Gehe dann durch alle Objekte durch und erstelle Eintrge neu
 	Extent e( d_txn );
 	QByteArray key;
-	key.reserve( 255 ); // RISK
-	if( e.first() ) do
+	Obj::Names names;
+	for( int j = 0; j < meta.d_items.size(); j++ )
+		names.append( meta.d_items[j].d_atom );
+	try
 	{
-		Obj o = e.getObj();
-		const QByteArray idstr = DataCell().setOid( o.getOid() ).writeCell();
-		key.clear();
-		DataCell value;
-		bool hasNulls = false;
-		for( int j = 0; j < meta.d_items.size() && !hasNulls; j++ )
+		if( e.first() ) do
 		{
-			o.getValue( meta.d_items[j].d_atom, value );
-			if( value.isNull() )
-				hasNulls = true;
-			else
-				Idx::addElement( key, meta.d_items[j], value );
-		}
-		if( !hasNulls )
+			Obj o = e.getObj();
+			const QByteArray idstr = DataCell().setOid( o.getOid() ).writeCell();
+			key.clear();
+			const Obj::ValueList values = o.getValues( names ); // ein Durchgang statt ein Seek pro Item
+			bool hasNulls = false;
+			for( int j = 0; j < meta.d_items.size() && !hasNulls; j++ )
+			{
+				if( values[j].isNull() )
+					hasNulls = true;
+				else
+					Idx::addElement( key, meta.d_items[j], values[j] );
+			}
+			if( !hasNulls )
+			{
+				if( meta.d_kind == IndexMeta::Value )
+					key += idstr;
+				buf[ key ] = idstr;
+				bufSize += key.size() + idstr.size() + 64; // RISK: grob geschaetzter Overhead pro Eintrag
+				if( maxSortMem > 0 && bufSize > maxSortMem )
+				{
+					_writeRun( buf, runs );
+					buf.clear();
+					bufSize = 0;
+				}
+			}
+		}while( e.next() );
+
+		if( runs.isEmpty() )
 		{
-			if( meta.d_kind == IndexMeta::Value )
-				key += idstr;
-			cur.insert( key, idstr );
+			_SortBuf::const_iterator i;
+			for( i = buf.begin(); i != buf.end(); ++i )
+				cur.insertSorted( i.key().d_ba, i.value() );
+		}else
+		{
+			if( !buf.isEmpty() )
+				_writeRun( buf, runs );
+			buf.clear();
+			_mergeRuns( runs, cur );
 		}
-	}while( e.next() );
+	}catch( ... )
+	{
+		qDeleteAll( runs );
+		throw;
+	}
+	qDeleteAll( runs );
 }
@@ -26,6 +26,7 @@
 namespace Udb
 {
 	class Transaction;
+	class BtreeCursor;
 	typedef quint64 OID;
 
 	// Udb Table Index Class
@@ -34,10 +35,21 @@ namespace Udb
 	public:
         typedef QList<Stream::DataCell> Keys;
 
-		Idx():d_txn(0),d_idx(0){}
+		class ScanGuard // Haelt den Scan-Cursor fuer die Lebensdauer des Guards offen
+		{
+		public:
+			ScanGuard( Idx& idx ):d_idx(idx),d_started(!idx.isScanning()) { if( d_started ) d_idx.beginScan(); }
+			~ScanGuard() { if( d_started ) d_idx.endScan(); }
+		private:
+			Idx& d_idx;
+			bool d_started;
+		};
+
+		Idx():d_txn(0),d_idx(0),d_scan(0),d_scanCount(0),d_scanValid(false){}
 		Idx( Transaction*, int idx );
 		Idx( Transaction*, const QByteArray& name );
 		Idx( const Idx& );
+		~Idx();
 
 		bool first();
 		bool last();
@@ -54,7 +66,15 @@ namespace Udb
         bool isOnIndex() const;
 		OID getOid();
 
-		void rebuildIndex(); // RISK: erstelle Index neu
+		// Scan-Modus: der Cursor bleibt zwischen den Aufrufen von next/prev/getOid positioniert
+		// und wird nur neu positioniert, wenn der Store seither geaendert wurde.
+		// VORSICHT: endScan vor Database::close bzw. BtreeStore::dropTable aufrufen.
+		void beginScan();
+		void endScan();
+		bool isScanning() const { return d_scan != 0; }
+
+		// RISK: erstelle Index neu; sortiert die Keys im Speicher bis maxSortMem Bytes, darueber extern
+		void rebuildIndex( int maxSortMem = 64 * 1024 * 1024 );
 		void clearIndex(); // RISK: lsche Index-Inhalt
 
 		bool isNull() const { return d_idx == 0; }
@@ -69,6 +89,11 @@ namespace Udb
 		static void collate( QByteArray&, quint8 collation, const QString& );
 	protected:
 		void checkNull() const;
+		BtreeCursor* cursor( BtreeCursor& tmp ) const;
+		bool isScanPos() const;
+		void setScanPos( bool valid );
+		void readCur( BtreeCursor* );
+		bool step( bool forward );
 	private:
 		friend class Transaction;
 		// NOTE: Hier wrde Database gengen. Da aber alle Txn bentigen, 
@@ -77,6 +102,9 @@ namespace Udb
 		int d_idx;
 		QByteArray d_cur;
 		QByteArray d_key;
+		BtreeCursor* d_scan; // nur im Scan-Modus, steht auf d_cur falls isScanPos
+		quint32 d_scanCount; // BtreeStore::getChangeCount bei letzter Positionierung
+		bool d_scanValid;
 	};
 }
 
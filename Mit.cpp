@@ -47,7 +47,7 @@ bool Mit::seek( const KeyList& key )
 {
 	// RISK: sucht nur in Db, nicht in Transaktion
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	d_key.clear();
 	d_cur.clear();
 	DataWriter w;
@@ -94,7 +94,7 @@ void Mit::getValue( Stream::DataCell& v ) const
 	if( !d_cur.startsWith( d_key ) )
 		return;
 
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getMapTable(), false );
 	if( cur.moveTo( d_cur ) )
@@ -133,7 +133,7 @@ Mit::KeyList Mit::getKey() const
 bool Mit::firstKey()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	d_cur.clear();
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getMapTable() );
@@ -148,7 +148,7 @@ bool Mit::firstKey()
 bool Mit::nextKey()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getMapTable() );
 	cur.moveTo( d_cur ); // zur letztbekannten oder neu verlangten Position
@@ -163,7 +163,7 @@ bool Mit::nextKey()
 bool Mit::prevKey()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getMapTable() );
 	cur.moveTo( d_cur ); // zur letztbekannten oder neu verlangten Position
@@ -200,7 +200,7 @@ bool Xit::seek( const QByteArray& key )
 {
 	// RISK: sucht nur in Db, nicht in Transaktion
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	d_key.clear();
 	d_cur.clear();
     d_key = DataCell().setOid( d_oid ).writeCell();
@@ -244,7 +244,7 @@ void Xit::getValue( Stream::DataCell& v ) const
 	if( !d_cur.startsWith( d_key ) )
 		return;
 
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getOixTable(), false );
 	if( cur.moveTo( d_cur ) )
@@ -271,7 +271,7 @@ QByteArray Xit::getKey() const
 bool Xit::firstKey()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	d_cur.clear();
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getOixTable() );
@@ -286,7 +286,7 @@ bool Xit::firstKey()
 bool Xit::nextKey()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getOixTable() );
 	cur.moveTo( d_cur ); // zur letztbekannten oder neu verlangten Position
@@ -301,7 +301,7 @@ bool Xit::nextKey()
 bool Xit::prevKey()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getOixTable() );
 	cur.moveTo( d_cur ); // zur letztbekannten oder neu verlangten Position
@@ -468,6 +468,26 @@ Obj::Names Obj::getNames() const
 	return d_txn->getUsedFields( d_oid );
 }
 
+Obj::ValueList Obj::getValues( const Names& names ) const
+{
+	checkNull();
+	ValueMap all;
+	const QSet<Atom> only = names.toSet();
+	d_txn->getFields( d_oid, all, &only );
+	ValueList res( names.size() );
+	for( int i = 0; i < names.size(); i++ )
+		res[i] = all.value( names[i] ); // Name 0 ist nie vorhanden und bleibt Null wie bei getValue
+	return res;
+}
+
+Obj::ValueMap Obj::getAllValues() const
+{
+	checkNull();
+	ValueMap all;
+	d_txn->getFields( d_oid, all );
+	return all;
+}
+
 Database* Obj::getDb() const
 {
 	checkNull();
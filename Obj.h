@@ -28,6 +28,7 @@
 #include <Udb/Mit.h>
 #include <QList>
 #include <QVector>
+#include <QMap>
 
 class QMimeData;
 
@@ -49,6 +50,7 @@ namespace Udb
 		typedef QVector<Stream::DataCell> KeyList;
         typedef QVector<Stream::DataCell> ValueList;
 		typedef QList<Atom> Names;
+		typedef QMap<Atom,Stream::DataCell> ValueMap;
 
 		Obj();
 		Obj( OID oid, Transaction* );
@@ -71,6 +73,10 @@ namespace Udb
 		Stream::DataCell getValue( Atom name, bool forceOldValue = false ) const;
 		QString getString( Atom name, bool stripMarkup = false ) const;
 		Names getNames() const;
+		// Liest alle Felder in einem Cursor-Durchgang statt einem Seek pro Feld, inkl. ungespeicherte
+		// Aenderungen der Transaktion. Reihenfolge wie names, fehlende Felder sind Null.
+		ValueList getValues( const Names& names ) const;
+		ValueMap getAllValues() const; // alle vorhandenen Felder inkl. reservierte
 		// -
 
 		// Identitaet
@@ -145,7 +151,7 @@ namespace Udb
 		quint64 deaggregateImp(bool notify); // returns parent or null
 		void setValuePriv( const Stream::DataCell&, Atom name );
 	private:
-		quint32 d_oid;
+		OID d_oid;
 		Transaction* d_txn;
 	};
 	inline bool operator==(const Udb::Obj& lhs, const Udb::Obj& rhs) { return lhs.equals(rhs); }
@@ -19,6 +19,7 @@
 
 #include "ObjChildMdl.h"
 #include <Udb/Transaction.h>
+#include <Udb/Record.h>
 #include <QtDebug>
 #include <cassert>
 using namespace Udb;
@@ -64,7 +65,7 @@ QModelIndex ObjChildMdl::index ( int row, int column, const QModelIndex & parent
 	{
 		if( row < d_items.size() && column < columnCount(parent) )
 		{
-			return createIndex( row, column, quint32(d_items[row].getOid()) );
+			return createIndex( row, column ); // Zeile ist der Index in d_items; eine OID passt nicht in jede interne Id
 		}
 	}
 	return QModelIndex();
@@ -76,7 +77,7 @@ QModelIndex ObjChildMdl::getIndex( const Obj & o, bool fetch ) const
 		return QModelIndex();
 	const int i = d_items.indexOf( o );
 	if( i != -1 )
-		return createIndex( i, 0, quint32(o.getOid()) );
+		return createIndex( i, 0 );
     else if( !fetch )
 		return QModelIndex();
     else
@@ -87,7 +88,7 @@ QModelIndex ObjChildMdl::getIndex( const Obj & o, bool fetch ) const
             const_cast<ObjChildMdl*>( this )->fetchMore( QModelIndex() );
 			const int i = d_items.indexOf( o, max );
             if( i != -1 )
-				return createIndex( i, 0, quint32(o.getOid()) );
+				return createIndex( i, 0 );
 			max = d_items.size();
         }while( canFetchMore( QModelIndex() ) );
         return QModelIndex();
@@ -142,17 +143,24 @@ int ObjChildMdl::fetch( int max, QList<Obj> *l ) const
 	}
 	// Wir gehen vom letzten (neusten) Slot richtung erstem (ltestem) und
 	// fgen die Slots an das Ende der Liste
+	// Typ und Verkettung pro Element in einem Durchgang lesen
+	const Obj::Names names = Obj::Names() << Record::FieldType
+		<< ( (d_inverted)? Record::FieldPrevObj : Record::FieldNextObj );
 	int n = 0;
-	if( !item.isNull() ) do
+	while( !item.isNull() )
 	{
-		if( useIt && isSupportedType( item.getType() ) )
+		const Obj::ValueList v = item.getValues( names );
+		if( useIt && isSupportedType( v[0].getAtom() ) )
 		{
 			if( l )
 				l->append( item );
 			n++;
 		}
 		useIt = true;
-	}while( ( (d_inverted)? item.prev() : item.next() ) && ( max == 0 || n < max ) );
+		if( v[1].isNull() || ( max != 0 && n >= max ) )
+			break;
+		item = Obj( v[1].getOid(), item.getTxn() );
+	}
 	return n;
 }
 
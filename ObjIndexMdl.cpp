@@ -140,6 +140,7 @@ void ObjIndexMdl::fetchMore ( const QModelIndex & parent )
 	Udb::Qit i;
 	// QTBUG: eigenartigerweise wird fetchMore auch aufgerufen, wenn canFetchMore false retourniert
 	int n = 0;
+	Udb::Idx::ScanGuard scan( d_idx ); // Cursor bleibt waehrend dem ganzen Batch positioniert
 	if( d_refetch )
 	{
 		d_refetch = false;
@@ -95,7 +95,7 @@ Stream::DataCell Qit::getValue() const
 bool Qit::first()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getQueTable() );
 	const QByteArray oid = DataCell().setOid( d_oid ).writeCell();
@@ -103,11 +103,12 @@ bool Qit::first()
 		return false;
 	if( !cur.moveNext() )
 		return false;
-	const QByteArray key = cur.readKey();
-	if( !key.startsWith( oid ) )
+	int len;
+	const char* key = cur.fetchKey( len );
+	if( len < oid.size() || ::memcmp( key, oid.constData(), oid.size() ) != 0 )
 		return false;
 	DataCell v;
-	v.readCell( key.mid( oid.length() ) );
+	v.readCell( QByteArray::fromRawData( key + oid.size(), len - oid.size() ) );
 	d_nr = v.getId32();
 	return true;
 }
@@ -115,7 +116,7 @@ bool Qit::first()
 bool Qit::last()
 {
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getQueTable() );
 	const QByteArray oid = DataCell().setOid( d_oid ).writeCell();
@@ -148,17 +149,19 @@ bool Qit::next()
 	if( d_nr == 0 )
 		return first();
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getQueTable() );
 	const QByteArray oid = DataCell().setOid( d_oid ).writeCell();
 	const QByteArray nr = DataCell().setId32( d_nr ).writeCell();
 	if( cur.moveTo( oid + nr ) )
 		cur.moveNext();
-	if( !cur.readKey().startsWith( oid ) )
+	int len;
+	const char* key = cur.fetchKey( len );
+	if( len < oid.size() || ::memcmp( key, oid.constData(), oid.size() ) != 0 )
 		return false;
 	DataCell v;
-	v.readCell( cur.readKey().mid( oid.length() ) );
+	v.readCell( QByteArray::fromRawData( key + oid.size(), len - oid.size() ) );
 	d_nr = v.getId32();
 	return true;
 }
@@ -168,18 +171,19 @@ bool Qit::prev()
 	if( d_nr == 0 )
 		return last();
 	checkNull();
-	Database::Lock lock( d_txn->getDb() );
+	Database::ReadLock lock( d_txn->getDb() );
 	BtreeCursor cur;
 	cur.open( d_txn->getDb()->getStore(), d_txn->getDb()->getQueTable() );
 	const QByteArray oid = DataCell().setOid( d_oid ).writeCell();
 	const QByteArray nr = DataCell().setId32( d_nr ).writeCell();
 	if( cur.moveTo( oid + nr ) )
 		cur.movePrev();
-	const QByteArray key = cur.readKey();
-	if( key == oid || !key.startsWith( oid ) )
-		return false;
+	int len;
+	const char* key = cur.fetchKey( len );
+	if( len <= oid.size() || ::memcmp( key, oid.constData(), oid.size() ) != 0 )
+		return false; // auch key == oid, das ist der Zaehler
 	DataCell v;
-	v.readCell( cur.readKey().mid( oid.length() ) );
+	v.readCell( QByteArray::fromRawData( key + oid.size(), len - oid.size() ) );
 	d_nr = v.getId32();
 	return true;
 }
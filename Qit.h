@@ -56,7 +56,7 @@ namespace Udb
 		bool isNull() const { return d_oid == 0; }
 	protected:
 		void checkNull() const;
-		quint32 d_oid;
+		OID d_oid;
 		Transaction* d_txn;
 		quint32 d_nr;
 	};
@@ -19,8 +19,10 @@
 
 #include "Record.h"
 #include "BtreeCursor.h"
+#include "BtreeStore.h"
 #include "DatabaseException.h"
 #include <Stream/DataWriter.h>
+#include <Stream/DataReader.h>
 #include <cassert>
 using namespace Udb;
 using namespace Stream;
@@ -29,30 +31,188 @@ Record::Record()
 {
 }
 
-void Record::writeField( BtreeCursor& cur, OID oid, Atom a, const Stream::DataCell& v )
+// Kompaktes Format: Atom ohne Cell-Tag als ordnungserhaltende Varint, d.h. memcmp-Reihenfolge
+// entspricht der numerischen. Laenge steckt in den fuehrenden Bits des ersten Bytes:
+// 0xxxxxxx | 10xxxxxx +1 | 110xxxxx +2 | 1110xxxx +3 | 11110000 +4
+static void _writeAtom( QByteArray& out, Atom a )
+{
+	if( a < 0x80 )
+		out.append( char( a ) );
+	else if( a < 0x4000 )
+	{
+		out.append( char( 0x80 | ( a >> 8 ) ) );
+		out.append( char( a ) );
+	}else if( a < 0x200000 )
+	{
+		out.append( char( 0xc0 | ( a >> 16 ) ) );
+		out.append( char( a >> 8 ) );
+		out.append( char( a ) );
+	}else if( a < 0x10000000 )
+	{
+		out.append( char( 0xe0 | ( a >> 24 ) ) );
+		out.append( char( a >> 16 ) );
+		out.append( char( a >> 8 ) );
+		out.append( char( a ) );
+	}else
+	{
+		out.append( char( 0xf0 ) );
+		out.append( char( a >> 24 ) );
+		out.append( char( a >> 16 ) );
+		out.append( char( a >> 8 ) );
+		out.append( char( a ) );
+	}
+}
+
+static bool _readAtom( const char* p, int len, Atom& a )
+{
+	if( len <= 0 )
+		return false;
+	const quint8 lead = quint8( p[0] );
+	int n;
+	if( lead < 0x80 )
+	{
+		n = 0;
+		a = lead;
+	}else if( lead < 0xc0 )
+	{
+		n = 1;
+		a = lead & 0x3f;
+	}else if( lead < 0xe0 )
+	{
+		n = 2;
+		a = lead & 0x1f;
+	}else if( lead < 0xf0 )
+	{
+		n = 3;
+		a = lead & 0x0f;
+	}else
+	{
+		n = 4;
+		a = 0;
+	}
+	if( len != n + 1 )
+		return false;
+	for( int i = 1; i <= n; i++ )
+		a = ( a << 8 ) | quint8( p[i] );
+	return true;
+}
+
+static QByteArray _fieldKey( const BtreeCursor& cur, OID oid, Atom a )
 {
+	if( cur.getDb()->hasCompactKeys() )
+	{
+		QByteArray key = DataCell().setOid( oid ).writeCell();
+		_writeAtom( key, a );
+		return key;
+	}
 	DataWriter w;
 	w.writeSlot( DataCell().setOid( oid ) ); // Wir verwenden Multybyte64, wahrscheinlich gengt 32bit
 	w.writeSlot( DataCell().setAtom( a ) );
+	return w.getStream();
+}
 
+static bool _readPacked( const QByteArray& row, Record::Values& out, const QSet<Atom>* only,
+						 Atom single = 0 )
+{
+	// single: nur dieses Atom suchen; true..gefunden
+	DataReader r( row );
+	DataCell v;
+	Atom a = 0;
+	bool haveAtom = false;
+	for( DataReader::Token t = r.nextToken(); DataReader::isUseful( t ); t = r.nextToken() )
+	{
+		if( t != DataReader::Slot )
+			throw DatabaseException( DatabaseException::DatabaseFormat, "invalid packed record" );
+		r.readValue( v );
+		if( !haveAtom )
+		{
+			a = v.getAtom();
+			haveAtom = true;
+			continue;
+		}
+		haveAtom = false;
+		if( single != 0 )
+		{
+			if( a == single )
+			{
+				out[a] = v;
+				return true;
+			}
+		}else if( only == 0 || only->contains( a ) )
+			out[a] = v;
+	}
+	return false;
+}
+
+static QByteArray _writePacked( const Record::Values& in )
+{
+	DataWriter w;
+	Record::Values::const_iterator i;
+	for( i = in.begin(); i != in.end(); ++i )
+	{
+		w.writeSlot( DataCell().setAtom( i.key() ) );
+		w.writeSlot( i.value() );
+	}
+	return w.getStream();
+}
+
+static bool _usesPacked( const BtreeCursor& cur, Atom a )
+{
+	return a < Record::MinReservedField && cur.getDb()->hasPackedRecords();
+}
+
+void Record::writeField( BtreeCursor& cur, OID oid, Atom a, const Stream::DataCell& v )
+{
+	if( _usesPacked( cur, a ) )
+	{
+		const QByteArray packed = _fieldKey( cur, oid, FieldPacked );
+		if( cur.moveTo( packed ) )
+		{
+			Values values;
+			_readPacked( cur.readValue(), values, 0 );
+			if( v.isNull() )
+				values.remove( a );
+			else
+				values[a] = v;
+			cur.insert( packed, _writePacked( values ) );
+			return;
+		}
+	}
+	const QByteArray key = _fieldKey( cur, oid, a );
 	if( v.isNull() )
 	{
-		if( cur.moveTo( w.getStream() ) )
+		if( cur.moveTo( key ) )
 			cur.removePos();
 	}else
-		cur.insert( w.getStream(), v.writeCell() );
+		cur.insert( key, v.writeCell() );
 }
 
-void Record::readField( BtreeCursor& cur, OID oid, Atom a, Stream::DataCell& v )
+void Record::readField( BtreeCursor& cur, OID oid, Atom a, Stream::DataCell& v, int* bytes )
 {
-	DataWriter w;
-	w.writeSlot( DataCell().setOid( oid ) ); // Wir verwenden Multybyte64, wahrscheinlich gengt 32bit
-	w.writeSlot( DataCell().setAtom( a ) );
-
-	if( cur.moveTo( w.getStream() ) )
-		v.readCell( cur.readValue() );
-	else
+	if( _usesPacked( cur, a ) && cur.moveTo( _fieldKey( cur, oid, FieldPacked ) ) )
+	{
+		const QByteArray row = cur.readValue();
+		Values values;
+		if( _readPacked( row, values, 0, a ) )
+			v = values.value( a );
+		else
+			v.setNull();
+		if( bytes )
+			*bytes = ( v.isNull() )? 0 : v.writeCell().size(); // Anteil an der Zeile
+		return;
+	}
+	if( cur.moveTo( _fieldKey( cur, oid, a ) ) )
+	{
+		const QByteArray value = cur.readValue();
+		if( bytes )
+			*bytes = value.size();
+		v.readCell( value );
+	}else
+	{
+		if( bytes )
+			*bytes = 0;
 		v.setNull();
+	}
 }
 
 OID Record::findObject( BtreeCursor& cur, const QUuid& uuid )
@@ -79,31 +239,147 @@ void Record::eraseFields( BtreeCursor& cur, OID oid )
 		if( cur.moveTo( value ) )
 			cur.removePos();
 	}
-	if( cur.moveTo( key, true ) ) do
+	cur.removeRange( key );
+}
+
+Record::FieldEnum::FieldEnum( BtreeCursor& cur, OID oid, bool all ):
+	d_cur( cur ),d_packedPos(0),d_atom(0),d_all(all),d_started(false)
+{
+	d_prefix = DataCell().setOid( oid ).writeCell();
+	d_compact = cur.getDb()->hasCompactKeys();
+}
+
+bool Record::FieldEnum::decode()
+{
+	// Atom der aktuellen Zeile direkt aus der Page; false..keine Feld-Zeile (<oid> -> <uuid>)
+	int len;
+	const char* k = d_cur.fetchKey( len );
+	const int prefix = d_prefix.size();
+	if( len <= prefix )
+		return false;
+	if( d_compact )
+		return _readAtom( k + prefix, len - prefix, d_atom );
+	// Atoms sind skalar, d_tmp haelt keine Referenz auf die Page
+	d_tmp.readCell( QByteArray::fromRawData( k + prefix, len - prefix ) );
+	if( !d_tmp.isAtom() )
+		return false;
+	d_atom = d_tmp.getAtom();
+	return true;
+}
+
+bool Record::FieldEnum::next()
+{
+	if( d_packedPos < d_packed.size() )
+	{
+		d_atom = d_packed[d_packedPos++];
+		return true;
+	}
+	while( true )
 	{
-		cur.removePos();
-	}while( cur.moveTo( key, true ) );
+		const bool ok = ( d_started )? d_cur.moveNext( d_prefix ) : d_cur.moveTo( d_prefix, true );
+		d_started = true;
+		if( !ok )
+			return false;
+		if( !decode() )
+			continue;
+		if( d_atom == FieldPacked )
+		{
+			Values values;
+			_readPacked( d_cur.readValue(), values, 0 );
+			d_packed = values.keys(); // nur nicht reservierte
+			d_packedPos = 0;
+			if( d_packed.isEmpty() )
+				continue;
+			d_atom = d_packed[d_packedPos++];
+			return true;
+		}
+		if( d_all || d_atom < MinReservedField )
+			return true;
+	}
 }
 
 Record::Fields Record::getFields( BtreeCursor& cur, OID oid, bool all )
 {
 	Fields f;
+	FieldEnum e( cur, oid, all );
+	while( e.next() )
+		f.append( e.getAtom() );
+	return f;
+}
+
+void Record::readFields( BtreeCursor& cur, OID oid, Values& out, const QSet<Atom>* only )
+{
 	const QByteArray key = DataCell().setOid( oid ).writeCell();
-	DataCell v;
+	const bool compact = cur.getDb()->hasCompactKeys();
 	if( cur.moveTo( key, true ) ) do
 	{
-		const QByteArray atom = cur.readKey().mid( key.size() );
-		if( !atom.isEmpty() )
+		int len;
+		const char* k = cur.fetchKey( len );
+		if( len <= key.size() )
+			continue; // <oid> -> <uuid>
+		Atom a;
+		if( compact )
 		{
-			v.readCell( atom );
-			if( v.isAtom() )
-			{
-				if( all || v.getAtom() < MinReservedField )
-					f.append( v.getAtom() );
-			}
+			if( !_readAtom( k + key.size(), len - key.size(), a ) )
+				continue;
+		}else
+		{
+			DataCell v;
+			v.readCell( QByteArray::fromRawData( k + key.size(), len - key.size() ) );
+			if( !v.isAtom() )
+				continue;
+			a = v.getAtom();
 		}
-	}while( cur.moveNext() && cur.readKey().startsWith( key ) );
-	return f;
+		if( a == FieldPacked )
+			_readPacked( cur.readValue(), out, only );
+		else if( only == 0 || only->contains( a ) )
+			out[a].readCell( cur.readValue() );
+	}while( cur.moveNext( key ) );
+}
+
+bool Record::isPacked( BtreeCursor& cur, OID oid )
+{
+	return cur.moveTo( _fieldKey( cur, oid, FieldPacked ) );
+}
+
+bool Record::packFields( BtreeCursor& cur, OID oid )
+{
+	if( isPacked( cur, oid ) )
+		return false;
+	Values values;
+	readFields( cur, oid, values );
+	QList<Atom> plain;
+	Values::iterator i = values.begin();
+	while( i != values.end() )
+	{
+		if( i.key() < MinReservedField )
+		{
+			plain.append( i.key() );
+			++i;
+		}else
+			i = values.erase( i );
+	}
+	for( int j = 0; j < plain.size(); j++ )
+	{
+		if( cur.moveTo( _fieldKey( cur, oid, plain[j] ) ) )
+			cur.removePos();
+	}
+	cur.insert( _fieldKey( cur, oid, FieldPacked ), _writePacked( values ) );
+	return true;
+}
+
+bool Record::unpackFields( BtreeCursor& cur, OID oid )
+{
+	const QByteArray packed = _fieldKey( cur, oid, FieldPacked );
+	if( !cur.moveTo( packed ) )
+		return false;
+	Values values;
+	_readPacked( cur.readValue(), values, 0 );
+	cur.removePos();
+	Values::const_iterator i;
+	for( i = values.begin(); i != values.end(); ++i )
+		cur.insert( _fieldKey( cur, oid, i.key() ), i.value().writeCell() );
+	return true;
 }
 
 void Record::setUuid( BtreeCursor& cur, OID oid, const QUuid& uuid )
@@ -41,22 +41,54 @@ namespace Udb
             FieldPrevObj, FieldNextObj,     // Vorheriges/nchstes aggregiertes Object mit gleichem Owner.
             FieldFirstObj, FieldLastObj,    // Liste der im Aggregat enthaltenen Objects.
 			// Mixed
-            FieldType                       // Speichert den Type des Object als Atom; bei Types steht also der ganze
+            FieldType,                      // Speichert den Type des Object als Atom; bei Types steht also der ganze
                                             // 32-Bit-Bereich zur Verfgung (bei Atoms nur bis MinReservedField, s.o.)
+			// Intern:
+			FieldPacked						// Zeile mit allen nicht reservierten Feldern eines gepackten Objekts
 		};
 		Record();
 
 		virtual bool isDeleted() const { return false; }
 
 		typedef QList<Atom> Fields;
+		typedef QMap<Atom,Stream::DataCell> Values;
 
 		static void writeField( BtreeCursor&, OID oid, Atom, const Stream::DataCell& );
-		static void readField( BtreeCursor&, OID oid, Atom, Stream::DataCell& );
+		static void readField( BtreeCursor&, OID oid, Atom, Stream::DataCell&, int* bytes = 0 ); // bytes..Groesse der Cell
 		static void eraseFields( BtreeCursor&, OID oid );
 		static void setUuid( BtreeCursor&, OID oid, const QUuid& );
 		static QUuid getUuid( BtreeCursor&, OID oid );
 		static OID findObject( BtreeCursor&, const QUuid& );
 		static Fields getFields( BtreeCursor&, OID oid, bool all = true );
+		// Ein Durchgang ueber alle Zeilen von oid; only..nur diese Felder dekodieren
+		static void readFields( BtreeCursor&, OID oid, Values&, const QSet<Atom>* only = 0 );
+		// Verschiebt alle nicht reservierten Felder in die gepackte Zeile bzw. zurueck in je eine Zeile;
+		// false..war bereits im verlangten Format
+		static bool packFields( BtreeCursor&, OID oid );
+		static bool unpackFields( BtreeCursor&, OID oid );
+		static bool isPacked( BtreeCursor&, OID oid );
+
+		// Streaming ueber die Felder eines Objekts ohne Zwischenliste; die Atoms werden direkt aus dem
+		// Key in der Page dekodiert, die Felder einer gepackten Zeile der Reihe nach geliefert.
+		// Der Cursor darf waehrenddessen nicht anderweitig bewegt werden.
+		class FieldEnum
+		{
+		public:
+			FieldEnum( BtreeCursor&, OID oid, bool all = true );
+			bool next(); // false..keine weiteren Felder
+			Atom getAtom() const { return d_atom; }
+		private:
+			bool decode();
+			BtreeCursor& d_cur;
+			QByteArray d_prefix;
+			Stream::DataCell d_tmp;
+			Fields d_packed;
+			int d_packedPos;
+			Atom d_atom;
+			bool d_all;
+			bool d_compact;
+			bool d_started;
+		};
 	};
 
 	/* Format
@@ -69,6 +101,18 @@ namespace Udb
 	<oid> <atom> -> <cell>
 	<null> -> <oid> : next id
 
+	Kompaktes Key-Format (Database::setCompactKeys, beim Anlegen gewaehlt, in der Meta als keyFormat):
+	<oid> <varint atom> -> <cell>
+	Das Atom wird ohne Cell-Tag als ordnungserhaltende Varint gespeichert (1 Byte bis 127, 2 Bytes
+	bis 16383), womit pro Feld-Zeile 2..4 Bytes wegfallen und mehr Zeilen in eine Page passen. Der
+	<oid>-Prefix bleibt unveraendert, Prefix-Suche mit moveTo/moveNext funktioniert wie bisher.
+
+	Gepackte Objekte (Database::setPackedType, pro Typ):
+	<oid> <FieldPacked> -> [ <atom> <cell> ]*
+	Alle nicht reservierten Felder stehen als Slot-Paare in einer Zeile; die reservierten Felder
+	(Typ, Aggregat-Verkettung) bleiben eigene Zeilen. Ist die Zeile vorhanden, lesen und schreiben
+	readField/writeField die nicht reservierten Felder nur darin.
+
 	Queue:
 	<oid> -> <id32> // next id
 	<oid> <id32> -> <cell>
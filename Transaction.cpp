@@ -26,6 +26,7 @@
 #include "Idx.h"
 #include <cassert>
 #include <QtDebug>
+#include <QThread>
 using namespace Udb;
 using namespace Stream;
 
@@ -47,7 +48,7 @@ bool Transaction::ByteArrayHolder::operator <( const ByteArrayHolder& rhs ) cons
 }
 
 Transaction::Transaction( Database* db, QObject* p ):
-	QObject(p),d_db(db),d_commitLock(false),d_individualNotify(true)
+	QObject(p),d_db(db),d_lockGen(1),d_commitLock(false),d_individualNotify(true)
 {
 	assert( db );
 }
@@ -56,6 +57,7 @@ Transaction::~Transaction()
 {
 	if( isActive() )
 		rollback();
+	waitForAsync(); // der Writer-Thread haelt einen Zeiger auf uns
 }
 
 Atom Transaction::getAtom( const QByteArray& name ) const
@@ -76,20 +78,30 @@ bool Transaction::isReadOnly() const
 void Transaction::checkLock( OID oid )
 {
 	// NOTE: Caller ist fr Database::Lock verantwortlich
-	QHash<quint32,Transaction*>::const_iterator i = d_db->d_objLocks.find( oid );
+	QHash<OID,Database::ObjLock>::iterator i = d_db->d_objLocks.find( oid );
 	if( i != d_db->d_objLocks.end() )
 	{
 		// Objekt ist bereits gelockt
-		if( i.value() != this )
+		if( i.value().first != this )
 			// Objekt ist bereits durch andere Transaktion gelockt
 			throw DatabaseException( DatabaseException::RecordLocked ); 
+		// Gehoert nun zum laufenden Satz; ein zuvor mit commitAsync abgegebener gibt ihn nicht frei
+		i.value().second = d_lockGen;
 	}else
 	{
 		// Objekt ist noch nicht gelockt
-		d_db->d_objLocks[oid] = this;
+		d_db->d_objLocks[oid] = qMakePair( this, d_lockGen );
 	}
 }
 
+void Transaction::releaseLock( OID oid, quint32 gen )
+{
+	// NOTE: Caller ist fuer Database::Lock verantwortlich
+	QHash<OID,Database::ObjLock>::iterator i = d_db->d_objLocks.find( oid );
+	if( i != d_db->d_objLocks.end() && i.value().first == this && i.value().second == gen )
+		d_db->d_objLocks.erase( i );
+}
+
 void Transaction::setField( OID oid, Atom a, const Stream::DataCell& v )
 {
 	Database::Lock lock( d_db );
@@ -100,25 +112,31 @@ void Transaction::setField( OID oid, Atom a, const Stream::DataCell& v )
 	if( d_db->d_objDeletes.contains( oid ) )
 		throw DatabaseException( DatabaseException::RecordDeleted, "cannot write to deleted record" );
 
-	d_changes[ qMakePair(quint32(oid),a) ] = v;
+	d_changes[ qMakePair(OID(oid),a) ] = v;
 }
 
 void Transaction::getField( OID oid, Atom a, Stream::DataCell& v, bool forceOld ) const
 {
     if( !forceOld )
     {
-        Changes::const_iterator i = d_changes.find( qMakePair(quint32(oid),a) );
+        Changes::const_iterator i = d_changes.find( qMakePair(OID(oid),a) );
         if( i != d_changes.end() )
         {
             v = i.value(); // Solange Delete nicht vollzogen ist, darf noch gelesen werden.
             return;
         }//else
+        if( findPending( qMakePair(OID(oid),a), false, v ) )
+            return;
     }
+    if( d_db->getCachedField( oid, a, v ) )
+        return;
 
-    Database::Lock lock( d_db );
+    Database::ReadLock lock( d_db );
     BtreeCursor cur;
     cur.open( d_db->getStore(), d_db->getObjTable(), false );
-    Record::readField( cur, oid, a, v );
+    int bytes;
+    Record::readField( cur, oid, a, v, &bytes );
+    d_db->cacheField( oid, a, v, bytes ); // noch unter ReadLock, damit kein Commit dazwischen kommt
 }
 
 void Transaction::erase( OID oid )
@@ -132,21 +150,23 @@ void Transaction::erase( OID oid )
 		throw DatabaseException( DatabaseException::RecordDeleted );
 	d_db->d_objDeletes.append( oid );
 	// Da commit deletes nur erkennt, wenn d_changes mind. einen Eintrag hat.
-	Stream::DataCell& v = d_changes[ qMakePair(quint32(oid),Atom(0)) ];
+	Stream::DataCell& v = d_changes[ qMakePair(OID(oid),Atom(0)) ];
 	if( !v.isNull() )
 		v.setNull(); 
 }
 
 bool Transaction::isErased( OID oid ) const
 {
-	Database::Lock lock( d_db );
+	Database::ReadLock lock( d_db );
 	return d_db->d_objDeletes.contains( oid );
 }
 
 OID Transaction::create()
 {
 	Database::Lock lock( d_db );
-	return d_db->getNextOid();
+	const OID oid = d_db->getNextOid();
+	d_created.append( oid );
+	return oid;
 }
 
 BtreeStore* Transaction::getStore() const
@@ -154,7 +174,22 @@ BtreeStore* Transaction::getStore() const
 	return d_db->getStore();
 }
 
-typedef QMap<QPair<quint32,Atom>,Stream::DataCell> Changes;
+typedef QMap<QPair<OID,Atom>,Stream::DataCell> Changes;
+
+static void _raiseQueueNr( const QByteArray& oid, quint32 nr, BtreeCursor& cur )
+{
+	// Zaehler <oid> -> hoechste reservierte Nummer; Database::getNextQueueNr setzt ihn bei der
+	// Reservation, hier nur fuer mit setQSlot explizit gesetzte hoehere Nummern
+	quint32 last = 0;
+	if( cur.moveTo( oid ) )
+	{
+		DataCell v;
+		v.readCell( cur.readValue() );
+		last = v.getId32();
+	}
+	if( nr > last )
+		cur.insert( oid, DataCell().setId32( nr ).writeCell() );
+}
 
 static void _saveQueue( const Changes& queue, BtreeCursor& cur )
 {
@@ -172,6 +207,9 @@ static void _saveQueue( const Changes& queue, BtreeCursor& cur )
 		{
 			cur.insert( oid + nr, j.value().writeCell( false, true ) ); // RISK: compression
 		}
+		Changes::const_iterator k = j + 1;
+		if( k == queue.end() || k.key().first != j.key().first )
+			_raiseQueueNr( oid, j.key().second, cur ); // letzte und damit hoechste Nummer dieser Queue
 	}
 }
 
@@ -194,11 +232,8 @@ static void _saveMap( const Transaction::Map& m, BtreeCursor& cur )
 static void _eraseQueue( OID id, BtreeCursor& cur, Changes& queue )
 {
 	const QByteArray oid = DataCell().setOid( id ).writeCell();
-	if( cur.moveTo( oid, true ) ) do
-	{
-		cur.removePos();
-	}while( cur.moveTo( oid, true ) );
-	Changes::iterator j = queue.lowerBound( qMakePair( quint32(id), quint32(0) ) );
+	cur.removeRange( oid );
+	Changes::iterator j = queue.lowerBound( qMakePair( OID(id), quint32(0) ) );
 	while( j != queue.end() && j.key().first == id )
 	{
 		j = queue.erase( j );
@@ -208,10 +243,7 @@ static void _eraseQueue( OID id, BtreeCursor& cur, Changes& queue )
 static void _eraseMap( OID id, BtreeCursor& cur, Transaction::Map& m )
 {
 	const QByteArray oid = DataCell().setOid( id ).writeCell();
-	if( cur.moveTo( oid, true ) ) do
-	{
-		cur.removePos();
-	}while( cur.moveTo( oid, true ) );
+	cur.removeRange( oid );
 	Transaction::Map::iterator j = m.lowerBound( oid );
 	while( j != m.end() && j.key().d_ba.startsWith( oid ) )
 	{
@@ -219,8 +251,163 @@ static void _eraseMap( OID id, BtreeCursor& cur, Transaction::Map& m )
 	}
 }
 
+static void _countType( BtreeCursor& cur, Atom type, bool add )
+{
+	const QByteArray key = DataCell().setAtom( type ).writeCell();
+	quint32 n = 0;
+	if( cur.moveTo( key ) )
+	{
+		DataCell v;
+		v.readCell( cur.readValue() );
+		n = v.getId32();
+	}
+	if( add )
+		n++;
+	else if( n > 0 )
+		n--;
+	cur.insert( key, DataCell().setId32( n ).writeCell() );
+}
+
+static void _retype( BtreeCursor& cur, OID id, Atom from, Atom to )
+{
+	// Typ-Index <type> <oid> -> leer, Zaehler <type> -> Anzahl; Objekte ohne Typ sind nicht erfasst
+	if( from == to )
+		return;
+	const QByteArray oid = DataCell().setOid( id ).writeCell();
+	if( from && cur.moveTo( DataCell().setAtom( from ).writeCell() + oid ) )
+	{
+		cur.removePos();
+		_countType( cur, from, false );
+	}
+	if( to )
+	{
+		cur.insert( DataCell().setAtom( to ).writeCell() + oid, QByteArray() );
+		_countType( cur, to, true );
+	}
+}
+
+void Transaction::writeChanges( Changes& changes, Changes& queue, Map& map, Map& oix, quint32 gen )
+{
+	// NOTE: Caller ist fuer Database::Lock verantwortlich
+	BtreeStore::WriteLock lock( d_db->getStore() );
+	
+	QList<QPair<QUuid,OID> > uuids; // neu gesetzte Uuids fuer den Cache
+	OID oid = 0;
+	bool skip = false;
+	Changes::const_iterator i;
+	BtreeCursor objCur;
+	objCur.open( d_db->getStore(), d_db->getObjTable(), true );
+	BtreeCursor qCur;
+	qCur.open( d_db->getStore(), d_db->getQueTable(), true );
+	BtreeCursor mCur;
+	mCur.open( d_db->getStore(), d_db->getMapTable(), true );
+	BtreeCursor xCur;
+	xCur.open( d_db->getStore(), d_db->getOixTable(), true );
+	BtreeCursor eCur;
+	eCur.open( d_db->getStore(), d_db->getExtTable(), true );
+	BtreeCursor tCur;
+	tCur.open( d_db->getStore(), d_db->getTypTable(), true );
+	// Changes beinhaltet pro Objekt und gendertem Feld einen Record.
+	for( i = changes.begin(); i != changes.end(); ++i )
+	{
+		if( i.key().first != oid )
+		{
+			// Wir sind in einem neuen Objekt angelangt.
+			skip = false;
+			oid = i.key().first;
+			// Lsche das Objekt falls ntig
+			if( d_db->d_objDeletes.contains( oid ) )
+			{
+				// Lsche Record mit allen Bestandteilen aus Store und Indizes
+				d_db->d_objDeletes.removeAll( oid );
+				Record::Fields f = Record::getFields( objCur, oid );
+				for( int j = 0; j < f.size(); j++ )
+				{
+					removeFromIndex( oid, f[j], objCur );
+					d_db->uncacheField( oid, f[j] );
+				}
+				d_db->uncacheUuid( oid, objCur );
+				Record::eraseFields( objCur, oid );
+				d_db->freeOid( oid, objCur );
+				// Allfllige weitere genderte Felder werden nach lschen ignoriert
+				_eraseQueue( oid, qCur, queue );
+				d_db->d_queueNrs.remove( oid );
+				_eraseMap( oid, mCur, map );
+				_eraseMap( oid, xCur, oix );
+				if( eCur.moveTo( DataCell().setOid( oid ).writeCell() ) )
+				{
+					DataCell old;
+					old.readCell( eCur.readValue() );
+					eCur.removePos();
+					_retype( tCur, oid, old.getAtom(), 0 );
+				}
+				skip = true;
+			}
+			// Entferne den Lock
+			// Es kann sein dass Objekt gar nicht gelockt ist oder inzwischen einem juengeren Satz gehoert.
+			releaseLock( oid, gen );
+			if( !skip )
+			{
+				// Objektverzeichnis <oid> -> <type> und Typ-Index fuer neue Objekte und bei Typwechsel
+				const QByteArray key = DataCell().setOid( oid ).writeCell();
+				Changes::const_iterator t = changes.find( qMakePair( OID(oid), Atom(Record::FieldType) ) );
+				DataCell old;
+				const bool known = eCur.moveTo( key );
+				if( known )
+					old.readCell( eCur.readValue() );
+				DataCell type;
+				if( t != changes.end() )
+					type = t.value();
+				else if( known )
+					type = old;
+				else
+					Record::readField( objCur, oid, Record::FieldType, type );
+				if( !known || type.getAtom() != old.getAtom() )
+				{
+					eCur.insert( key, type.writeCell() );
+					_retype( tCur, oid, old.getAtom(), type.getAtom() );
+				}
+				// Objekte gepackter Typen vor dem ersten Feld in die gepackte Zeile bringen
+				if( d_db->d_meta.d_packedTypes.contains( type.getAtom() ) )
+					Record::packFields( objCur, oid );
+			}
+		}
+		if( !skip )
+		{
+			if( i.key().second )
+			{
+				removeFromIndex( oid, i.key().second, objCur ); // alles alte Werte
+				Record::writeField( objCur, oid, i.key().second, i.value() );
+				d_db->uncacheField( oid, i.key().second );
+				addToIndex( oid, changes, i.key().second, objCur ); // neue Werte, soweit vorhanden; rest alte
+			}else if( i.value().isUuid() )
+			{
+				d_db->uncacheUuid( oid, objCur );
+				Record::setUuid( objCur, oid, i.value().getUuid() );
+				uuids.append( qMakePair( i.value().getUuid(), oid ) );
+			}
+		}
+	}
+	// Speichere Bestandteile auf Record-Ebene
+	_saveMap( map, mCur );
+	_saveMap( oix, xCur );
+	_saveQueue( queue, qCur );
+	// Cursor vor dem Commit schliessen, wie sonst beim Verlassen des Scope vor ~WriteLock
+	objCur.close();
+	qCur.close();
+	mCur.close();
+	xCur.close();
+	eCur.close();
+	tCur.close();
+	lock.commit();
+	// Erst nach transCommit; in einer Commit-Gruppe verwirft checkUuidAborts bei Abbruch
+	for( int j = 0; j < uuids.size(); j++ )
+		d_db->cacheUuid( uuids[j].first, uuids[j].second );
+}
+
 void Transaction::commit()
 {
+	waitForAsync(); // zuvor abgegebene Aenderungen muessen zuerst geschrieben sein
 	if( !isActive() )
 		return;
 	if( d_db->isReadOnly() )
@@ -238,70 +425,45 @@ void Transaction::commit()
 	{
 		// RISK: ev. Exceptions abfangen
 	}
-	Database::Lock lock( d_db );
+	quint32 group = 0;
 	{
-		BtreeStore::WriteLock lock2( d_db->getStore() );
-		
-		quint32 oid = 0;
-		bool skip = false;
-		Changes::const_iterator i;
-		BtreeCursor objCur;
-		objCur.open( d_db->getStore(), d_db->getObjTable(), true );
-		BtreeCursor qCur;
-		qCur.open( d_db->getStore(), d_db->getQueTable(), true );
-		BtreeCursor mCur;
-		mCur.open( d_db->getStore(), d_db->getMapTable(), true );
-        BtreeCursor xCur;
-		xCur.open( d_db->getStore(), d_db->getOixTable(), true );
-		// Changes beinhaltet pro Objekt und gendertem Feld einen Record.
-		for( i = d_changes.begin(); i != d_changes.end(); ++i )
+		Database::Lock lock( d_db );
+		group = d_db->joinCommitGroup(); // 0 ohne Gruppen-Commit
+		try
 		{
-			if( i.key().first != oid )
-			{
-				// Wir sind in einem neuen Objekt angelangt.
-				skip = false;
-				oid = i.key().first;
-				// Lsche das Objekt falls ntig
-				if( d_db->d_objDeletes.contains( oid ) )
-				{
-					// Lsche Record mit allen Bestandteilen aus Store und Indizes
-					d_db->d_objDeletes.removeAll( oid );
-					Record::Fields f = Record::getFields( objCur, oid );
-					for( int j = 0; j < f.size(); j++ )
-						removeFromIndex( oid, f[j], objCur );
-					Record::eraseFields( objCur, oid );
-					// TODO: OID an Freelist hngen
-					// Allfllige weitere genderte Felder werden nach lschen ignoriert
-					_eraseQueue( oid, qCur, d_queue );
-					_eraseMap( oid, mCur, d_map );
-                    _eraseMap( oid, xCur, d_oix );
-					skip = true;
-				}
-				// Entferne den Lock
-				// Es kann sein dass Objekt gar nicht gelockt ist.
-				d_db->d_objLocks.remove( oid );
-			}
-			if( !skip )
-			{
-				if( i.key().second )
-				{
-					removeFromIndex( oid, i.key().second, objCur ); // alles alte Werte
-					Record::writeField( objCur, oid, i.key().second, i.value() );
-					addToIndex( oid, d_changes, i.key().second, objCur ); // neue Werte, soweit vorhanden; rest alte
-				}else if( i.value().isUuid() )
-					Record::setUuid( objCur, oid, i.value().getUuid() );
-			}
+			writeChanges( d_changes, d_queue, d_map, d_oix, d_lockGen );
+		}catch( const DatabaseException& e )
+		{
+			d_db->abortCommitGroup( group, e.getMsg() );
+			d_commitLock = false;
+			throw;
+		}catch( ... )
+		{
+			d_db->abortCommitGroup( group, "commit failed" );
+			d_commitLock = false;
+			throw;
 		}
-		// Speichere Bestandteile auf Record-Ebene
-		_saveMap( d_map, mCur );
-        _saveMap( d_oix, xCur );
-		_saveQueue( d_queue, qCur );
 		d_changes.clear();
 		d_queue.clear();
 		d_map.clear();
         d_oix.clear();
 		d_uuidCache.clear();
+		d_created.clear();
 	}
+	if( group )
+	{
+		// Erst nach dem gemeinsamen Sync ist die Transaktion dauerhaft
+		try
+		{
+			d_db->waitCommitGroup( group );
+		}catch( ... )
+		{
+			d_notify.clear();
+			d_commitLock = false;
+			throw;
+		}
+	}
+	Database::Lock lock( d_db );
 	for( int i = 0; i < d_notify.size(); i++ )
 	{
 		try
@@ -323,6 +485,257 @@ void Transaction::commit()
     d_commitLock = false;
 }
 
+static QFuture<bool> _finished( bool ok )
+{
+	QFutureInterface<bool> res;
+	res.reportStarted();
+	res.reportResult( ok );
+	res.reportFinished();
+	return res.future();
+}
+
+QFuture<bool> Transaction::commitAsync()
+{
+	if( !isActive() )
+		return _finished( true );
+	if( d_db->isReadOnly() )
+	{
+		rollback();
+		return _finished( false );
+	}
+	if( d_commitLock )
+		return _finished( false );
+#ifndef DATABASE_HAS_MUTEX
+	// Ohne Mutexe sperren Database::Lock und BtreeStore::WriteLock nichts; der Writer-Thread wuerde
+	// parallel zu den Cursorn dieses Threads auf den nicht threadsicheren Btree schreiben.
+	commit();
+	return _finished( true );
+#else
+	d_commitLock = true;
+	try
+	{
+		doNotify( UpdateInfo( UpdateInfo::PreCommit ) );
+	}catch( ... )
+	{
+		// RISK: ev. Exceptions abfangen
+	}
+	// Die Aenderungen wandern unveraendert in einen Pending-Satz; die Objekt-Locks bleiben
+	// bestehen, bis der Writer-Thread sie geschrieben hat.
+	PendingPtr p( new Pending() );
+	p->d_changes = d_changes;
+	p->d_queue = d_queue;
+	p->d_map = d_map;
+	p->d_oix = d_oix;
+	p->d_uuidCache = d_uuidCache;
+	p->d_notify = d_notify;
+	{
+		// Locks, die ab jetzt gesetzt oder erneuert werden, gehoeren zum naechsten Satz
+		Database::Lock lock( d_db );
+		p->d_gen = d_lockGen++;
+	}
+	p->d_result.reportStarted();
+	const QFuture<bool> res = p->d_result.future();
+	{
+		QMutexLocker l( &d_pendingLock );
+		d_pending.append( p );
+	}
+	d_changes.clear();
+	d_queue.clear();
+	d_map.clear();
+	d_oix.clear();
+	d_uuidCache.clear();
+	d_created.clear();
+	d_notify.clear();
+	d_db->enqueueWrite( this );
+	// Commit-Notification erst nach erfolgreichem Schreiben, siehe deliverAsync
+	d_commitLock = false;
+	return res;
+#endif
+}
+
+void Transaction::waitForAsync()
+{
+	// d_pending wird nur von diesem Thread veraendert; der Writer liest und setzt d_taken
+	forever
+	{
+		QFuture<bool> f;
+		{
+			QMutexLocker l( &d_pendingLock );
+			if( d_pending.isEmpty() )
+				return;
+			f = d_pending.first()->d_result.future();
+		}
+		f.waitForFinished();
+		prunePending();
+		if( QThread::currentThread() == thread() )
+			deliverAsync(); // nicht auf die Event-Loop warten; commit() meldet sonst vor dem Vorgaenger
+	}
+}
+
+void Transaction::prunePending() const
+{
+	QMutexLocker l( &d_pendingLock );
+	while( !d_pending.isEmpty() && d_pending.first()->d_result.isFinished() )
+		d_pending.removeFirst();
+}
+
+void Transaction::writePending()
+{
+	// Laeuft im Writer-Thread der Database, pro enqueueWrite genau einmal
+	PendingPtr p;
+	{
+		QMutexLocker l( &d_pendingLock );
+		for( int i = 0; i < d_pending.size(); i++ )
+		{
+			if( !d_pending[i]->d_taken )
+			{
+				p = d_pending[i];
+				p->d_taken = true;
+				break;
+			}
+		}
+	}
+	if( p.isNull() )
+		return;
+	// Kopien, da writeChanges geloeschte Objekte austraegt und der Aufrufer-Thread weiterhin liest
+	Changes changes = p->d_changes;
+	Changes queue = p->d_queue;
+	Map map = p->d_map;
+	Map oix = p->d_oix;
+	bool ok = true;
+	quint32 group = 0;
+	try
+	{
+		{
+			Database::Lock lock( d_db );
+			group = d_db->joinCommitGroup();
+			try
+			{
+				writeChanges( changes, queue, map, oix, p->d_gen );
+			}catch( const DatabaseException& e )
+			{
+				d_db->abortCommitGroup( group, e.getMsg() );
+				throw;
+			}catch( ... )
+			{
+				d_db->abortCommitGroup( group, "commit failed" );
+				throw;
+			}
+			p->d_written = true;
+		}
+		if( group )
+			d_db->waitCommitGroup( group );
+	}catch( ... )
+	{
+		ok = false;
+		Database::Lock lock( d_db );
+		p->d_written = true;
+		Changes::const_iterator i;
+		for( i = changes.begin(); i != changes.end(); ++i )
+		{
+			d_db->d_objDeletes.removeAll( i.key().first );
+			releaseLock( i.key().first, p->d_gen );
+		}
+	}
+	if( ok )
+	{
+		// Observer sind oft direkt verbunden (Modelle) und duerfen nicht im Writer-Thread laufen
+		{
+			QMutexLocker l( &d_pendingLock );
+			d_delivery.append( p );
+		}
+		// Vor reportFinished, da die Transaktion danach geloescht werden kann; Qt verwirft dann das Event
+		QMetaObject::invokeMethod( this, "deliverAsync", Qt::QueuedConnection );
+	}
+	p->d_result.reportResult( ok );
+	p->d_result.reportFinished();
+}
+
+void Transaction::deliverAsync()
+{
+	// Im Thread der Transaktion, der auch die Database gehoert
+	QList<PendingPtr> done;
+	{
+		QMutexLocker l( &d_pendingLock );
+		done = d_delivery;
+		d_delivery.clear();
+	}
+	for( int n = 0; n < done.size(); n++ )
+	{
+		{
+			Database::Lock lock( d_db );
+			for( int i = 0; i < done[n]->d_notify.size(); i++ )
+			{
+				try
+				{
+					emit d_db->notify( done[n]->d_notify[i] );
+				}catch( ... )
+				{
+					// RISK: ev. Exceptions abfangen
+				}
+			}
+		}
+		try
+		{
+			doNotify( UpdateInfo( UpdateInfo::Commit ) );
+		}catch( ... )
+		{
+			// RISK: ev. Exceptions abfangen
+		}
+	}
+}
+
+bool Transaction::findPending( const QPair<OID,quint32>& key, bool queue, Stream::DataCell& v ) const
+{
+	prunePending();
+	QMutexLocker l( &d_pendingLock );
+	// Juengster Satz zuerst
+	for( int n = d_pending.size() - 1; n >= 0; n-- )
+	{
+		const Changes& c = (queue)? d_pending[n]->d_queue : d_pending[n]->d_changes;
+		Changes::const_iterator i = c.find( key );
+		if( i != c.end() )
+		{
+			v = i.value();
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Transaction::findPending( const QByteArray& key, bool oix, Stream::DataCell& v ) const
+{
+	prunePending();
+	QMutexLocker l( &d_pendingLock );
+	for( int n = d_pending.size() - 1; n >= 0; n-- )
+	{
+		const Map& m = (oix)? d_pending[n]->d_oix : d_pending[n]->d_map;
+		Map::const_iterator i = m.find( key );
+		if( i != m.end() )
+		{
+			v = i.value();
+			return true;
+		}
+	}
+	return false;
+}
+
+quint32 Transaction::pendingGen( OID oid ) const
+{
+	// NOTE: Caller ist fuer Database::Lock verantwortlich, unter dem d_written gesetzt wird
+	QMutexLocker l( &d_pendingLock );
+	for( int n = d_pending.size() - 1; n >= 0; n-- )
+	{
+		if( d_pending[n]->d_written )
+			continue;
+		const Changes& c = d_pending[n]->d_changes;
+		Changes::const_iterator i = c.lowerBound( qMakePair( OID(oid), Atom(0) ) );
+		if( i != c.end() && i.key().first == oid )
+			return d_pending[n]->d_gen;
+	}
+	return 0;
+}
+
 void Transaction::rollback()
 {
 	if( !isActive() )
@@ -338,7 +751,7 @@ void Transaction::rollback()
 		// RISK: ev. Exceptions abfangen
 	}
 	Database::Lock lock( d_db );
-	quint32 oid = 0;
+	OID oid = 0;
 	Changes::const_iterator i;
 	for( i = d_changes.begin(); i != d_changes.end(); ++i )
 	{
@@ -347,11 +760,29 @@ void Transaction::rollback()
 			oid = i.key().first;
 			// Entferne die Lschung
 			d_db->d_objDeletes.removeAll( oid );
-			// Entferne den Lock (falls vorhanden; nicht bei new)
-			d_db->d_objLocks.remove( oid );
+			// Entferne den Lock (falls vorhanden; nicht bei new). Ein abgegebener, noch nicht
+			// geschriebener Satz mit demselben Objekt behaelt ihn.
+			QHash<OID,Database::ObjLock>::iterator l = d_db->d_objLocks.find( oid );
+			if( l != d_db->d_objLocks.end() && l.value().first == this && l.value().second == d_lockGen )
+			{
+				const quint32 gen = pendingGen( oid );
+				if( gen )
+					l.value().second = gen;
+				else
+					d_db->d_objLocks.erase( l );
+			}
 		}
-		// TODO: OIDs von neuen Objekten an Freelist hngen
 	}
+	if( d_db->isRecycleOids() && !d_created.isEmpty() )
+	{
+		// Neue Objekte wurden nie geschrieben; ihre OIDs gehen zurueck an die Freelist
+		BtreeStore::WriteLock guard( d_db->getStore() );
+		BtreeCursor objCur;
+		objCur.open( d_db->getStore(), d_db->getObjTable(), true );
+		for( int j = 0; j < d_created.size(); j++ )
+			d_db->freeOid( d_created[j], objCur );
+	}
+	d_created.clear();
 	d_changes.clear();
 	d_queue.clear();
 	d_map.clear();
@@ -382,12 +813,12 @@ Obj Transaction::createObject( Atom type, bool createUuid )
 	if( type && type >= Record::MinReservedField )
 		throw DatabaseException(DatabaseException::ReservedName );
 	if( type )
-		d_changes[qMakePair(quint32(oid),Atom(Record::FieldType)) ].setAtom( type );
+		d_changes[qMakePair(OID(oid),Atom(Record::FieldType)) ].setAtom( type );
 
 	if( createUuid )
 	{
 		QUuid u = QUuid::createUuid();
-		d_changes[qMakePair(quint32(oid),Atom(0)) ].setUuid( u );
+		d_changes[qMakePair(OID(oid),Atom(0)) ].setUuid( u );
 		d_uuidCache[u] = oid;
 	}
 
@@ -420,18 +851,99 @@ Obj Transaction::getObject( const QUuid& uuid ) const
 	OID oid = d_uuidCache.value( uuid );
 	if( oid )
 		return Obj( oid, const_cast<Transaction*>(this) );
-	Database::Lock lock( d_db );
+	prunePending();
+	{
+		QMutexLocker l( &d_pendingLock );
+		for( int n = d_pending.size() - 1; n >= 0 && oid == 0; n-- )
+			oid = d_pending[n]->d_uuidCache.value( uuid );
+	}
+	if( oid )
+		return Obj( oid, const_cast<Transaction*>(this) );
+	oid = d_db->getCachedOid( uuid );
+	if( oid )
+		return Obj( oid, const_cast<Transaction*>(this) );
+	Database::ReadLock lock( d_db );
 	BtreeCursor cur;
 	cur.open( d_db->getStore(), d_db->getObjTable(), false );
 	oid = Record::findObject( cur, uuid );
+	d_db->cacheUuid( uuid, oid );
 	return Obj( oid, const_cast<Transaction*>(this) );
 }
 
+QList<Obj> Transaction::getObjects( const QList<QUuid>& uuids ) const
+{
+	QVector<OID> oids( uuids.size() );
+	QMap<ByteArrayHolder,QList<int> > todo; // Uuid-Cell -> Positionen in uuids, in Key-Reihenfolge
+	prunePending();
+	QMutexLocker l( &d_pendingLock );
+	for( int i = 0; i < uuids.size(); i++ )
+	{
+		if( uuids[i].isNull() )
+			continue;
+		OID oid = d_uuidCache.value( uuids[i] );
+		for( int n = d_pending.size() - 1; n >= 0 && oid == 0; n-- )
+			oid = d_pending[n]->d_uuidCache.value( uuids[i] );
+		if( oid == 0 )
+			oid = d_db->getCachedOid( uuids[i] );
+		if( oid )
+			oids[i] = oid;
+		else
+			todo[ DataCell().setUuid( uuids[i] ).writeCell() ].append( i );
+	}
+	l.unlock();
+	if( !todo.isEmpty() )
+	{
+		// Ein Cursor wandert vorwaerts durch den Bereich der Uuid-Keys und vergleicht ihn mit den
+		// sortierten gesuchten Keys (Merge). Nur bei grossen Luecken wird wieder gesucht.
+		Database::ReadLock lock( d_db );
+		BtreeCursor cur;
+		cur.open( d_db->getStore(), d_db->getObjTable(), false );
+		QMap<ByteArrayHolder,QList<int> >::const_iterator j = todo.begin();
+		cur.moveTo( j.key().d_ba );
+		int steps = 0;
+		while( j != todo.end() && cur.isValidPos() )
+		{
+			int len;
+			const char* key = cur.fetchKey( len );
+			const QByteArray& target = j.key().d_ba;
+			int cmp = ::memcmp( key, target.constData(), qMin( len, target.size() ) );
+			if( cmp == 0 )
+				cmp = len - target.size();
+			if( cmp < 0 )
+			{
+				// Cursor steht vor dem gesuchten Key
+				if( ++steps > 64 )
+				{
+					cur.moveTo( target ); // steht danach auf target oder dem naechst groesseren Key
+					steps = 0;
+				}else
+					cur.moveNext();
+				continue;
+			}
+			if( cmp == 0 )
+			{
+				DataCell v;
+				v.readCell( cur.readValue() );
+				const OID oid = v.getOid();
+				d_db->cacheUuid( uuids[j.value().first()], oid );
+				for( int k = 0; k < j.value().size(); k++ )
+					oids[j.value()[k]] = oid;
+			}
+			++j; // cmp > 0: gesuchte Uuid existiert nicht
+			steps = 0;
+		}
+	}
+	QList<Obj> res;
+	for( int i = 0; i < oids.size(); i++ )
+		res.append( Obj( oids[i], const_cast<Transaction*>(this) ) );
+	return res;
+}
+
 Obj Transaction::createObject( const QUuid& uuid, Atom type )
 {
 	// TODO: sicherstellen, dass nicht bereits ein Objekt mit der gegebenen uuid existiert
 	Obj o = createObject( type );
-	d_changes[qMakePair(quint32(o.getOid()),Atom(0)) ].setUuid( uuid );
+	d_changes[qMakePair(o.getOid(),Atom(0)) ].setUuid( uuid );
 	d_uuidCache[uuid] = o.getOid();
 	return o;
 }
@@ -446,17 +958,26 @@ Obj Transaction::getOrCreateObject( const QUuid& uuid, Atom type )
 
 QUuid Transaction::getUuid( OID oid, bool create )
 {
-	Changes::const_iterator i = d_changes.find( qMakePair(quint32(oid),Atom(0)) );
+	Changes::const_iterator i = d_changes.find( qMakePair(OID(oid),Atom(0)) );
+	DataCell pending;
 	if( i != d_changes.end() &&  i.value().isUuid() )
 		return i.value().getUuid(); // Solange Delete nicht vollzogen ist, darf noch gelesen werden.
+	else if( findPending( qMakePair(OID(oid),Atom(0)), false, pending ) && pending.isUuid() )
+		return pending.getUuid();
 	else
 	{
 		Database::Lock lock( d_db );
 		BtreeCursor cur;
 		cur.open( d_db->getStore(), d_db->getObjTable(), false );
-		QUuid u = Record::getUuid( cur, oid );
+		QUuid u = d_db->getCachedUuid( oid );
 		if( !u.isNull() )
 			return u;
+		u = Record::getUuid( cur, oid );
+		if( !u.isNull() )
+		{
+			d_db->cacheUuid( u, oid );
+			return u;
+		}
 		if( !create )
 			return QUuid();
 		// Es gibt noch keine Uuid
@@ -464,7 +985,7 @@ QUuid Transaction::getUuid( OID oid, bool create )
 		if( isActive() )
 		{
 			// Wir sind in Transaktion. Schreibe erst bei Commit in die DB.
-			d_changes[qMakePair(quint32(oid),Atom(0)) ].setUuid( u );
+			d_changes[qMakePair(OID(oid),Atom(0)) ].setUuid( u );
 			d_uuidCache[u] = oid;
 		}else
 		{
@@ -473,6 +994,9 @@ QUuid Transaction::getUuid( OID oid, bool create )
 			cur.close();
 			cur.open( d_db->getStore(), d_db->getObjTable(), true );
 			Record::setUuid( cur, oid, u );
+			cur.close();
+			lock.commit();
+			d_db->cacheUuid( u, oid );
 		}
 		return u;
 	}
@@ -554,7 +1078,7 @@ void Transaction::addToIndex(OID id, const Changes& all, Atom a, BtreeCursor& ob
 					// Gehe durch alle Felder des Index und prfe, ob das Feld entweder im nderungsspeicher "all"
 					// vorhanden ist, oder ob es aus der DB gelesen werden muss.
 					// Seit 5.9.10 werden auch Null-Werte in den Index geschrieben, wenn wenigstens ein Element nicht null ist.
-					Changes::const_iterator it = all.find( qMakePair( quint32(id), meta.d_items[j].d_atom ) );
+					Changes::const_iterator it = all.find( qMakePair( OID(id), meta.d_items[j].d_atom ) );
 					if( it == all.end() )
 					{
 						// Das Feld wurde nicht gendert, sondern muss im Originalzustand aus der DB geholt werden.
@@ -587,19 +1111,80 @@ void Transaction::addToIndex(OID id, const Changes& all, Atom a, BtreeCursor& ob
 	}
 }
 
-Obj::Names Transaction::getUsedFields( OID oid ) const
+static void _overlay( const Changes& c, OID oid, QMap<Atom,Stream::DataCell>& out, const QSet<Atom>* only )
 {
-	// TODO: teuer
-	Database::Lock lock( d_db );
-	BtreeCursor cur;
-	cur.open( d_db->getStore(), d_db->getObjTable(), false );
-	Obj::Names names = Record::getFields( cur, oid, false );
 	Changes::const_iterator i;
-	for( i = d_changes.lowerBound( qMakePair( quint32(oid), Atom(0) ) ); 
-		i != d_changes.end() && i.key().first == oid; ++i )
+	for( i = c.lowerBound( qMakePair( OID(oid), Atom(1) ) ); // Atom 0 ist die uuid
+		i != c.end() && i.key().first == oid; ++i )
+	{
+		if( only && !only->contains( i.key().second ) )
+			continue;
+		if( i.value().isNull() )
+			out.remove( i.key().second );
+		else
+			out[ i.key().second ] = i.value();
+	}
+}
+
+void Transaction::getFields( OID oid, QMap<Atom,Stream::DataCell>& out, const QSet<Atom>* only ) const
+{
+	out.clear();
+	{
+		Database::ReadLock lock( d_db );
+		BtreeCursor cur;
+		cur.open( d_db->getStore(), d_db->getObjTable(), false );
+		Record::readFields( cur, oid, out, only );
+	}
+	{
+		prunePending();
+		QMutexLocker l( &d_pendingLock );
+		for( int n = 0; n < d_pending.size(); n++ ) // aeltester zuerst, juengere ueberschreiben
+			_overlay( d_pending[n]->d_changes, oid, out, only );
+	}
+	_overlay( d_changes, oid, out, only );
+}
+
+static void _mergeNames( Obj::Names& names, const Changes& c, OID oid )
+{
+	// names ist aufsteigend sortiert, ebenso die Changes eines Objekts; linearer Merge ohne Duplikate
+	Changes::const_iterator i = c.lowerBound( qMakePair( OID(oid), Atom(1) ) ); // Atom 0 ist die uuid
+	if( i == c.end() || i.key().first != oid )
+		return;
+	Obj::Names res;
+	res.reserve( names.size() + 8 );
+	int j = 0;
+	for( ; i != c.end() && i.key().first == oid && i.key().second < Record::MinReservedField; ++i )
 	{
-		if( i.key().second < Record::MinReservedField && !names.contains( i.key().second ) )
-			names.append( i.key().second );
+		const Atom a = i.key().second;
+		while( j < names.size() && names[j] < a )
+			res.append( names[j++] );
+		if( j < names.size() && names[j] == a )
+			j++;
+		res.append( a );
+	}
+	while( j < names.size() )
+		res.append( names[j++] );
+	names = res;
+}
+
+Obj::Names Transaction::getUsedFields( OID oid ) const
+{
+	Obj::Names names;
+	{
+		Database::ReadLock lock( d_db );
+		BtreeCursor cur;
+		cur.open( d_db->getStore(), d_db->getObjTable(), false );
+		Record::FieldEnum e( cur, oid, false );
+		while( e.next() )
+			names.append( e.getAtom() );
+	}
+	qSort( names ); // Key-Reihenfolge ist nur im kompakten Format numerisch
+	_mergeNames( names, d_changes, oid );
+	{
+		prunePending();
+		QMutexLocker l( &d_pendingLock );
+		for( int n = 0; n < d_pending.size(); n++ )
+			_mergeNames( names, d_pending[n]->d_changes, oid );
 	}
 	return names;
 }
@@ -617,15 +1202,17 @@ void Transaction::getQSlot( OID oid, quint32 nr, Stream::DataCell& v ) const
 	v.setNull();
 	if( oid == 0 )
 		return;
-	Database::Lock lock( d_db );
+	Database::ReadLock lock( d_db );
 	if( nr != 0 )
 	{
-		Changes::const_iterator i = d_queue.find( qMakePair(quint32(oid),nr) );
+		Changes::const_iterator i = d_queue.find( qMakePair(OID(oid),nr) );
 		if( i != d_queue.end() )
 		{
 			v = i.value(); // Solange Delete nicht vollzogen ist, darf noch gelesen werden.
 			return;
 		}//else
+		if( findPending( qMakePair(OID(oid),nr), true, v ) )
+			return;
 	}
 	BtreeCursor cur;
 	cur.open( d_db->getStore(), d_db->getQueTable(), false );
@@ -650,7 +1237,7 @@ void Transaction::setQSlot( OID oid, quint32 nr, const Stream::DataCell& v )
 	if( d_db->d_objDeletes.contains( oid ) )
 		throw DatabaseException( DatabaseException::RecordDeleted, "cannot write to deleted record" );
 
-	d_queue[ qMakePair(quint32(oid),nr) ] = v;
+	d_queue[ qMakePair(OID(oid),nr) ] = v;
 }
 
 void Transaction::getCell( OID oid, const Obj::KeyList& key, Stream::DataCell& v ) const
@@ -658,7 +1245,7 @@ void Transaction::getCell( OID oid, const Obj::KeyList& key, Stream::DataCell& v
 	v.setNull();
 	if( oid == 0 )
 		return;
-	Database::Lock lock( d_db );
+	Database::ReadLock lock( d_db );
 	DataWriter k;
 	k.writeSlot( DataCell().setOid( oid ) );
 	for( int i = 0; i < key.size(); i++ )
@@ -669,6 +1256,8 @@ void Transaction::getCell( OID oid, const Obj::KeyList& key, Stream::DataCell& v
 		v = i.value(); // Solange Delete nicht vollzogen ist, darf noch gelesen werden.
 		return;
 	}//else
+	if( findPending( k.getStream(), false, v ) )
+		return;
 	BtreeCursor cur;
 	cur.open( d_db->getStore(), d_db->getMapTable(), false );
 	if( cur.moveTo( k.getStream() ) )
@@ -700,7 +1289,7 @@ void Transaction::getCell( OID oid, const QByteArray& key, Stream::DataCell& v )
 	v.setNull();
 	if( oid == 0 )
 		return;
-	Database::Lock lock( d_db );
+	Database::ReadLock lock( d_db );
     QByteArray b = DataCell().setOid( oid ).writeCell();
     b += key;
 	Map::const_iterator i = d_oix.find( b );
@@ -709,6 +1298,8 @@ void Transaction::getCell( OID oid, const QByteArray& key, Stream::DataCell& v )
 		v = i.value(); // Solange Delete nicht vollzogen ist, darf noch gelesen werden.
 		return;
 	}//else
+	if( findPending( b, true, v ) )
+		return;
 	BtreeCursor cur;
 	cur.open( d_db->getStore(), d_db->getOixTable(), false );
 	if( cur.moveTo( b ) )
@@ -23,6 +23,11 @@
 #include <QObject>
 #include <QHash>
 #include <QMap>
+#include <QSet>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QFuture>
+#include <QFutureInterface>
 #include <Stream/DataCell.h>
 #include <Udb/UpdateInfo.h>
 #include <Udb/Obj.h>
@@ -40,7 +45,7 @@ namespace Udb
 	{
 		Q_OBJECT
 	public:
-		typedef QMap<QPair<quint32,Atom>,Stream::DataCell> Changes; // Wir koennen nicht QHash nehmen. Es muss geordnet sein.
+		typedef QMap<QPair<OID,Atom>,Stream::DataCell> Changes; // Wir koennen nicht QHash nehmen. Es muss geordnet sein.
 		struct ByteArrayHolder
 		{
 			// Dieser Trick ist noetig, da QByteArray::operator< intern qstrcmp verwendet, das mit 0-Zeichen scheitert
@@ -55,6 +60,14 @@ namespace Udb
 
 		// begin() gibt es nicht. Txn wird automatisch gestartet bei lock, create, set, erase
 		void commit();
+		// Uebergibt die Aenderungen dem Writer-Thread der Database und kehrt sofort zurueck.
+		// Das Resultat wird true, sobald die Aenderungen dauerhaft geschrieben sind, sonst false.
+		// Bis dahin sieht diese Transaktion ihre Aenderungen weiterhin und die Objekte bleiben gesperrt.
+		// Commit- und Post-Commit-Notifications folgen erst nach dem Schreiben, per Event-Loop
+		// im Thread der Transaktion oder spaetestens in waitForAsync.
+		// Ohne DATABASE_HAS_MUTEX wird synchron mit commit() geschrieben und das Resultat ist sofort da.
+		QFuture<bool> commitAsync();
+		void waitForAsync(); // blockiert, bis alle mit commitAsync uebergebenen Aenderungen geschrieben sind
 		void rollback();
 		bool isActive() const { return !d_changes.isEmpty() || !d_notify.isEmpty(); }
 
@@ -63,6 +76,9 @@ namespace Udb
 		Obj getObject( OID oid ) const;
 		Obj getObject( const Stream::DataCell& ) const;
 		Obj getObject( const QUuid& ) const;
+		// Loest alle uuids in einem Durchgang mit aufsteigend sortierten Keys auf; Resultat in der
+		// Reihenfolge von uuids, nicht gefundene als Null-Obj
+		QList<Obj> getObjects( const QList<QUuid>& ) const;
 		Obj getOrCreateObject( const QUuid&, Atom type = 0 ); 
 		QUuid getUuid( OID oid, bool create );
 
@@ -82,14 +98,41 @@ namespace Udb
 		const Changes& getChanges() const { return d_changes; }
 	signals:
 		void notify( Udb::UpdateInfo );  // Pre-Commit Notify
+	private slots:
+		void deliverAsync(); // Notifications geschriebener Saetze, im Thread der Transaktion
 	private:
 		friend class Obj;
 		friend class Idx;
 		friend class Qit;
 		friend class Extent;
+		friend class AsyncWriter;
+		struct Pending // mit commitAsync uebergeben, aber noch nicht geschrieben
+		{
+			Changes d_changes;
+			Changes d_queue;
+			Map d_map;
+			Map d_oix;
+			QMap<QUuid, OID> d_uuidCache;
+			QList<UpdateInfo> d_notify;
+			QFutureInterface<bool> d_result;
+			quint32 d_gen; // d_lockGen des Satzes
+			bool d_taken; // vom Writer-Thread uebernommen
+			bool d_written; // writeChanges ist durch, die Locks des Satzes sind frei; unter Database::Lock
+			Pending():d_gen(0),d_taken(false),d_written(false){}
+		};
+		typedef QSharedPointer<Pending> PendingPtr;
+		void writeChanges( Changes&, Changes& queue, Map&, Map& oix, quint32 gen );
+		void releaseLock( OID, quint32 gen ); // nur wenn der Lock noch zum Satz gen gehoert
+		quint32 pendingGen( OID ) const; // juengster noch nicht geschriebener Satz mit OID oder 0
+		void writePending(); // im Writer-Thread
+		void prunePending() const;
+		bool findPending( const QPair<OID,quint32>&, bool queue, Stream::DataCell& ) const;
+		bool findPending( const QByteArray&, bool oix, Stream::DataCell& ) const;
 		void setField( OID oid, Atom, const Stream::DataCell& );
 		void getField( OID oid, Atom, Stream::DataCell&, bool forceOld = false ) const;
 		Obj::Names getUsedFields( OID ) const;
+		// Gespeicherte Felder in einem Durchgang, ueberlagert von pending und d_changes; ohne Null-Werte
+		void getFields( OID oid, QMap<Atom,Stream::DataCell>&, const QSet<Atom>* only = 0 ) const;
 		OID getIdField( OID, Atom id ) const; // Helper for getField
 		void erase( OID oid );
 		bool isErased( OID oid ) const;
@@ -111,11 +154,16 @@ namespace Udb
 	private:
 		Changes d_changes; // oid+Atom-> Geaenderter Wert, oid+0 -> uuid | null
 		Changes d_queue;	// oid+nr->Geaenderter Wert
-		QMap<QUuid, quint32> d_uuidCache; // uuid->oid
+		QMap<QUuid, OID> d_uuidCache; // uuid->oid
+		QList<OID> d_created; // seit letztem Commit vergebene OIDs
 		Map d_map; 
         Map d_oix;
 		QList<UpdateInfo> d_notify;
 		QList<Callback> d_callbacks;
+		mutable QList<PendingPtr> d_pending; // aeltester zuerst; nur der eigene Thread veraendert die Liste
+		QList<PendingPtr> d_delivery; // geschrieben, Notifications noch ausstehend; unter d_pendingLock
+		mutable QMutex d_pendingLock; // fuer jeden Zugriff auf d_pending, d_taken und d_delivery
+		quint32 d_lockGen; // laufender Satz; commitAsync beginnt einen neuen
 		Database* d_db;
         bool d_commitLock; // Gegen doppelte Commit-Calls aus Pre-Commit-Notification
         bool d_individualNotify;
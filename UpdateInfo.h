@@ -49,19 +49,19 @@ namespace Udb
 		};
         static const char* s_kindName[];
 		quint8 d_kind;
-		quint32 d_id;
+		quint64 d_id; // oid oder nr
 		union
 		{
 			quint32 d_name;
-			quint32 d_parent;
+			quint64 d_parent;
 		};
 		union
 		{
-			quint32 d_before;
+			quint64 d_before;
 			quint32 d_name2;
 		};
 		QVector<Stream::DataCell> d_key;
-		UpdateInfo(quint8 k = 0):d_kind(k),d_name(0),d_id(0),d_before(0){}
+		UpdateInfo(quint8 k = 0):d_kind(k),d_id(0),d_parent(0),d_before(0){}
         QString toString() const;
         static QString toString( const QVector<Stream::DataCell>&);
 	};